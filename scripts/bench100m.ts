@@ -9,6 +9,7 @@ import { createIo } from '../src/node/nand/fatfs/io';
 import { NandIoLayer } from '../src/node/nand/fatfs/layer';
 import { Xtsn } from '../src/node/nand/xtsn';
 import { NxDiskIo } from '../src/node/nand/fatfs/diskio';
+import { SectorCacheOptions } from '../src/node/nand/fatfs/cache';
 import { Fat32FileSystem, FatError } from '../src/node/nand/fatfs/fs';
 import { BiosParameterBlock } from '../src/node/nand/fatfs/bpb';
 import { getLayer, XorOffsetCrypto } from '../src/node/nand/fatfs/layer.test.util';
@@ -31,7 +32,7 @@ const file = await createFile('/tmp/100m.dat', 100_000_000);
 // create file system overlay
 //
 
-const createFs = async (size: number, crypto?: Crypto) => {
+const createFs = async (size: number, crypto?: Crypto, cache?: SectorCacheOptions) => {
   const sectorSize = 512;
 
   // the "NandIoLayer" wraps the encryption logic (and reading writing to partition offsets)
@@ -47,7 +48,7 @@ const createFs = async (size: number, crypto?: Crypto) => {
 
   // create FAT32 WASM driver
   const ff = await FatFs.create({
-    diskio: new NxDiskIo({ ioLayer: nandIo, readonly: false }),
+    diskio: new NxDiskIo({ ioLayer: nandIo, readonly: false, cache }),
   });
 
   // format the blank disk with an empty FAT32 filesystem
@@ -152,6 +153,17 @@ const integrationBench = new Bench({ time: 10000 })
         fat32 = await createFs(disk.size, xtsn);
       },
     },
+  )
+  .add(
+    '100mb file, encrypted, cached',
+    async () => {
+      await benchmark('xtsn-cached', fat32);
+    },
+    {
+      async beforeAll() {
+        fat32 = await createFs(disk.size, xtsn, { maxSectors: 8192, readAheadSectors: 64 });
+      },
+    },
   );
 
 type BenchmarkResults = {
@@ -115,7 +115,11 @@ interface FSModule {
   readFile(path: string, opts: { encoding: 'binary'; flags?: string | undefined }): Uint8Array;
   readFile(path: string, opts: { encoding: 'utf8'; flags?: string | undefined }): string;
   readFile(path: string, opts?: { flags?: string | undefined }): Uint8Array;
-  writeFile(path: string, data: string | ArrayBufferView, opts?: { flags?: string | undefined }): void;
+  writeFile(
+    path: string,
+    data: string | ArrayBufferView,
+    opts?: { flags?: string | undefined; canOwn?: boolean | undefined },
+  ): void;
 
   //
   // module-level FS code
@@ -154,6 +158,11 @@ interface FSModule {
 interface ExtendedEmscriptenModule extends EmscriptenModule {
   onExit(code: number): void;
   callMain(argv: string[]): number;
+  /**
+   * called with each write to an NSP when hacbrewpack is run with `--nspsink`,
+   * `data` is a view of the wasm heap, so it must be copied before returning
+   */
+  onNspWrite?(name: string, position: number, data: Uint8Array): void;
 
   FS: FSModule;
 }
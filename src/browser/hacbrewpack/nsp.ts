@@ -3,7 +3,18 @@ import NSPWorker from './nsp.worker?worker';
 
 import { NACP, VideoCapture } from '@tootallnate/nacp';
 import { fetchBinary } from '../fetch';
-import { BuildNSPArgs, HacBrewPackResult, StartupUserAccount, Screenshots, LogoType, HacBrewPackArgs } from './types';
+import {
+  BuildNSPArgs,
+  HacBrewPackResult,
+  StartupUserAccount,
+  Screenshots,
+  LogoType,
+  HacBrewPackArgs,
+  HacBrewPackBatchArgs,
+  HacBrewPackBatchResult,
+  NspChunk,
+  NspSink,
+} from './types';
 
 import defaultStartupMovie from '../../public/StartupMovie.gif';
 import defaultLogo from '../../public/NintendoLogo.png';
@@ -11,7 +22,7 @@ import defaultImage from '../../public/DefaultNSPImage.jpg';
 import exefsMain from '../../public/exefs/main.nso';
 import exefsMainNpdm from '../../public/exefs/main.npdm';
 
-export async function buildNsp(args: BuildNSPArgs): Promise<HacBrewPackResult> {
+function createNacp(args: BuildNSPArgs): NACP {
   const nacp = new NACP();
   nacp.id = args.id;
   nacp.title = args.title;
@@ -22,12 +33,29 @@ export async function buildNsp(args: BuildNSPArgs): Promise<HacBrewPackResult> {
   nacp.videoCapture = args.videoCapture ?? VideoCapture.Disabled;
   nacp.logoType = args.logoType ?? LogoType.Nothing;
   nacp.logoHandling = 0;
+  return nacp;
+}
 
+function runWorker<T>(
+  message: HacBrewPackArgs | HacBrewPackBatchArgs,
+  getSink: (name: string) => NspSink | undefined = () => undefined,
+): Promise<T> {
   const worker = new NSPWorker();
-  const result = new Promise<HacBrewPackResult>((resolve, reject) => {
-    worker.onmessage = (event: MessageEvent<HacBrewPackResult>) => {
-      resolve(event.data);
+  // sinks can be async, so chunks are written one after another, and finished before the result is returned
+  let writes = Promise.resolve();
+  const result = new Promise<T>((resolve, reject) => {
+    worker.onmessage = (event: MessageEvent<T | NspChunk>) => {
+      const data = event.data as NspChunk;
+      if (data.type === 'nspChunk') {
+        const sink = getSink(data.name);
+        if (sink) {
+          writes = writes.then(() => sink(data));
+        }
+        return;
+      }
+
       worker.terminate();
+      writes.then(() => resolve(event.data as T), reject);
     };
     worker.onerror = (event) => {
       reject(event);
@@ -35,8 +63,20 @@ export async function buildNsp(args: BuildNSPArgs): Promise<HacBrewPackResult> {
     };
   });
 
+  worker.postMessage(message);
+
+  return result;
+}
+
+function memoryBudgetArgv(memoryBudget?: number): string[] {
+  return memoryBudget ? ['--membudget', String(memoryBudget)] : [];
+}
+
+export async function buildNsp(args: BuildNSPArgs): Promise<HacBrewPackResult> {
+  const nacp = createNacp(args);
+
   const message: HacBrewPackArgs = {
-    argv: ['--nopatchnacplogo', '--titleid', args.id],
+    argv: ['--nopatchnacplogo', '--titleid', args.id, ...memoryBudgetArgv(args.memoryBudget)],
     controlNacp: new Uint8Array(nacp.buffer),
     keys: args.keys,
     fileName: args.fileName,
@@ -47,9 +87,43 @@ export async function buildNsp(args: BuildNSPArgs): Promise<HacBrewPackResult> {
     nextArgv: [args.nroPath, ...args.nroArgv].join(' '),
     main: await fetchBinary(exefsMain),
     mainNpdm: await fetchBinary(exefsMainNpdm),
+    stream: args.sink !== undefined,
   };
 
-  worker.postMessage(message);
+  return runWorker(message, () => args.sink);
+}
 
-  return result;
+/**
+ * Builds several NSPs in a single worker, which is much quicker than calling `buildNsp` for each.
+ * The keys and memory budget of the first title are used for all of them, and NSPs are only
+ * streamed if every title has a `sink`.
+ */
+export async function buildNsps(args: BuildNSPArgs[]): Promise<HacBrewPackBatchResult> {
+  if (args.length === 0) {
+    return { stdout: '', stderr: '', exitCode: 0, nsps: [] };
+  }
+
+  const defaultImageData = await fetchBinary(defaultImage);
+  const message: HacBrewPackBatchArgs = {
+    argv: ['--nopatchnacplogo', ...memoryBudgetArgv(args[0].memoryBudget)],
+    keys: args[0].keys,
+    logo: await fetchBinary(defaultLogo),
+    startupMovie: await fetchBinary(defaultStartupMovie),
+    main: await fetchBinary(exefsMain),
+    mainNpdm: await fetchBinary(exefsMainNpdm),
+    titles: args.map((title) => ({
+      id: title.id,
+      controlNacp: new Uint8Array(createNacp(title).buffer),
+      fileName: title.fileName,
+      image: title.image ?? defaultImageData,
+      logo: title.logo,
+      startupMovie: title.startupMovie,
+      nextNroPath: title.nroPath,
+      nextArgv: [title.nroPath, ...title.nroArgv].join(' '),
+    })),
+    stream: args.every((title) => title.sink !== undefined),
+  };
+
+  const sinks = new Map(args.map((title) => [`${title.id.toLowerCase()}.nsp`, title.sink]));
+  return runWorker(message, (name) => sinks.get(name));
 }
@@ -1,8 +1,19 @@
-import { HacBrewPackArgs, HacBrewPackResult } from './types';
+import {
+  Data,
+  HacBrewPackArgs,
+  HacBrewPackBatchArgs,
+  HacBrewPackBatchResult,
+  HacBrewPackResult,
+  NspChunk,
+} from './types';
 import wasmHacBrewPack from './hacbrewpack';
 
-onmessage = (event: MessageEvent<HacBrewPackArgs>) => {
-  runHacBrewPack(event.data)
+const NSP_OUT_DIRECTORY = '/hacbrewpack_nsp';
+
+onmessage = (event: MessageEvent<HacBrewPackArgs | HacBrewPackBatchArgs>) => {
+  const args = event.data;
+  const run = 'titles' in args ? runHacBrewPackBatch(args) : runHacBrewPack(args);
+  run
     .then((result) => postMessage(result))
     .catch((err) => {
       console.error(`Failed to build NSP: `, err);
@@ -10,37 +21,68 @@ onmessage = (event: MessageEvent<HacBrewPackArgs>) => {
     });
 };
 
-async function runHacBrewPack(args: HacBrewPackArgs): Promise<HacBrewPackResult> {
-  const stdout: string[] = [];
-  const stderr: string[] = [];
-  const { FS, callMain } = await wasmHacBrewPack({
+async function loadHacBrewPack(stdout: string[], stderr: string[], stream?: boolean) {
+  const hacbrewpack = await wasmHacBrewPack({
     // wasm will immediately call main when we initialise it if we don't disable it
     // we don't want it to run immediately, because we have some setup to do
     noInitialRun: true,
     print: (line) => stdout.push(line),
     printErr: (line) => stderr.push(line),
+    // pass each write straight on, so the NSP never has to fit in the wasm heap or MEMFS
+    onNspWrite: stream ? postChunk : undefined,
   });
 
-  FS.writeFile('/keys.dat', args.keys);
+  // the message is only used to fill MEMFS, so let it keep our buffers instead of copying them
+  const { FS } = hacbrewpack;
+  const writeFile = (path: string, data: Data) => FS.writeFile(path, toBytes(data), { canOwn: true });
+
+  return { ...hacbrewpack, writeFile };
+}
+
+// MEMFS keeps owned data as a byte array
+function toBytes(data: Data): string | Uint8Array {
+  return typeof data === 'string' ? data : new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+}
+
+function postChunk(name: string, position: number, data: Uint8Array) {
+  const chunk: NspChunk = {
+    type: 'nspChunk',
+    name: name.slice(name.lastIndexOf('/') + 1),
+    position,
+    data: data.slice(),
+  };
+  postMessage(chunk, { transfer: [chunk.data.buffer] });
+}
+
+function streamArgv(args: HacBrewPackArgs | HacBrewPackBatchArgs): string[] {
+  return args.stream ? ['--nspsink'] : [];
+}
+
+async function runHacBrewPack(args: HacBrewPackArgs): Promise<HacBrewPackResult> {
+  const stdout: string[] = [];
+  const stderr: string[] = [];
+  const { FS, callMain, writeFile } = await loadHacBrewPack(stdout, stderr, args.stream);
+
+  writeFile('/keys.dat', args.keys);
 
   FS.mkdir('/control');
-  FS.writeFile('/control/control.nacp', args.controlNacp);
-  FS.writeFile('/control/icon_AmericanEnglish.dat', args.image);
+  writeFile('/control/control.nacp', args.controlNacp);
+  writeFile('/control/icon_AmericanEnglish.dat', args.image);
 
   FS.mkdir('/exefs');
-  FS.writeFile('/exefs/main', args.main);
-  FS.writeFile('/exefs/main.npdm', args.mainNpdm);
+  writeFile('/exefs/main', args.main);
+  writeFile('/exefs/main.npdm', args.mainNpdm);
 
   FS.mkdir('/logo');
-  FS.writeFile('/logo/NintendoLogo.png', args.logo);
-  FS.writeFile('/logo/StartupMovie.gif', args.startupMovie);
+  writeFile('/logo/NintendoLogo.png', args.logo);
+  writeFile('/logo/StartupMovie.gif', args.startupMovie);
 
   FS.mkdir('/romfs');
-  FS.writeFile('/romfs/nextArgv', args.nextArgv);
-  FS.writeFile('/romfs/nextNroPath', args.nextNroPath);
+  writeFile('/romfs/nextArgv', args.nextArgv);
+  writeFile('/romfs/nextNroPath', args.nextNroPath);
 
-  const exitCode = callMain(args.argv);
-  if (exitCode !== 0) {
+  const exitCode = callMain([...args.argv, ...streamArgv(args)]);
+  if (exitCode !== 0 || args.stream) {
     return {
       stdout: stdout.join('\n'),
       stderr: stderr.join('\n'),
@@ -48,7 +90,6 @@ async function runHacBrewPack(args: HacBrewPackArgs): Promise<HacBrewPackResult>
     };
   }
 
-  const NSP_OUT_DIRECTORY = '/hacbrewpack_nsp';
   const [nspFilename] = FS.readdir(NSP_OUT_DIRECTORY).filter((n) => n.endsWith('.nsp'));
   const data = FS.readFile(`${NSP_OUT_DIRECTORY}/${nspFilename}`);
 
@@ -59,3 +100,72 @@ async function runHacBrewPack(args: HacBrewPackArgs): Promise<HacBrewPackResult>
     nsp: new File([data], args.fileName ?? nspFilename),
   };
 }
+
+/**
+ * Builds every title with a single `callMain`, since the runtime exits after main returns.
+ * The exefs and shared logo are only written once, and each title gets its own control and romfs.
+ */
+async function runHacBrewPackBatch(args: HacBrewPackBatchArgs): Promise<HacBrewPackBatchResult> {
+  const stdout: string[] = [];
+  const stderr: string[] = [];
+  const { FS, callMain, writeFile } = await loadHacBrewPack(stdout, stderr, args.stream);
+
+  writeFile('/keys.dat', args.keys);
+
+  FS.mkdir('/exefs');
+  writeFile('/exefs/main', args.main);
+  writeFile('/exefs/main.npdm', args.mainNpdm);
+
+  FS.mkdir('/logo');
+  writeFile('/logo/NintendoLogo.png', args.logo);
+  writeFile('/logo/StartupMovie.gif', args.startupMovie);
+
+  const manifest: string[] = [];
+  FS.mkdir('/titles');
+  for (const title of args.titles) {
+    const dir = `/titles/${title.id}`;
+    FS.mkdir(dir);
+    manifest.push(`[${title.id}]`);
+
+    FS.mkdir(`${dir}/control`);
+    writeFile(`${dir}/control/control.nacp`, title.controlNacp);
+    writeFile(`${dir}/control/icon_AmericanEnglish.dat`, title.image);
+    manifest.push(`controldir = ${dir}/control`);
+
+    FS.mkdir(`${dir}/romfs`);
+    writeFile(`${dir}/romfs/nextArgv`, title.nextArgv);
+    writeFile(`${dir}/romfs/nextNroPath`, title.nextNroPath);
+    manifest.push(`romfsdir = ${dir}/romfs`);
+
+    if (title.logo || title.startupMovie) {
+      FS.mkdir(`${dir}/logo`);
+      FS.writeFile(`${dir}/logo/NintendoLogo.png`, title.logo ?? args.logo);
+      FS.writeFile(`${dir}/logo/StartupMovie.gif`, title.startupMovie ?? args.startupMovie);
+      manifest.push(`logodir = ${dir}/logo`);
+    }
+  }
+  FS.writeFile('/manifest.txt', manifest.join('\n'));
+
+  const exitCode = callMain([...args.argv, ...streamArgv(args), '--manifest', '/manifest.txt']);
+  if (exitCode !== 0 || args.stream) {
+    return {
+      stdout: stdout.join('\n'),
+      stderr: stderr.join('\n'),
+      exitCode,
+      nsps: [],
+    };
+  }
+
+  const nsps = args.titles.map((title) => {
+    const nspFilename = `${title.id.toLowerCase()}.nsp`;
+    const data = FS.readFile(`${NSP_OUT_DIRECTORY}/${nspFilename}`);
+    return new File([data], title.fileName ?? nspFilename);
+  });
+
+  return {
+    exitCode,
+    stdout: stdout.join('\n'),
+    stderr: stderr.join('\n'),
+    nsps,
+  };
+}
@@ -77,8 +77,35 @@ export interface BuildNSPArgs {
    * Defaults to disabled, since it requires extra memory to be allocated.
    */
   videoCapture?: VideoCapture;
+  /**
+   * Streams the NSP out in chunks while it's built, instead of returning it as a `File`.
+   * See `NspSink`.
+   */
+  sink?: NspSink;
+  /**
+   * Memory budget for hacbrewpack's read and write buffers, in MB.
+   */
+  memoryBudget?: number;
 }
 
+export interface NspChunk {
+  type: 'nspChunk';
+  /**
+   * file name of the NSP the chunk belongs to
+   */
+  name: string;
+  position: number;
+  data: Uint8Array;
+}
+
+/**
+ * Receives an NSP as it's built. Chunks arrive in order, apart from the header at the start
+ * of the NSP, which is written again once everything else is done.
+ * A `FileSystemWritableFileStream` can be used with:
+ *  `(chunk) => stream.write({ type: 'write', position: chunk.position, data: chunk.data })`
+ */
+export type NspSink = (chunk: NspChunk) => void | Promise<void>;
+
 export type Data = string | ArrayBufferView;
 export interface HacBrewPackArgs {
   /**
@@ -128,6 +155,11 @@ export interface HacBrewPackArgs {
    */
   main: Data;
   mainNpdm: Data;
+
+  /**
+   * Post the NSP back in `NspChunk` messages as it's built, instead of returning it in the result.
+   */
+  stream?: boolean;
 }
 
 export interface HacBrewPackResult {
@@ -136,3 +168,42 @@ export interface HacBrewPackResult {
   exitCode: number;
   nsp?: File;
 }
+
+/**
+ * A title built as part of a batch, see `HacBrewPackBatchArgs`.
+ */
+export interface HacBrewPackBatchTitle {
+  /**
+   * title id, used to name the NSP and patched into the npdm and nacp
+   */
+  id: string;
+  controlNacp: Data;
+  image: Data;
+  nextArgv: Data;
+  nextNroPath: Data;
+  fileName?: string;
+  /**
+   * overrides the shared logo and startup animation
+   */
+  logo?: Data;
+  startupMovie?: Data;
+}
+
+/**
+ * Builds several NSPs with one instance of `hacbrewpack`, so the keys are only
+ * loaded once, and the exefs and logo shared between titles are only hashed once.
+ */
+export interface HacBrewPackBatchArgs
+  extends Omit<HacBrewPackArgs, 'controlNacp' | 'image' | 'nextArgv' | 'nextNroPath' | 'fileName'> {
+  titles: HacBrewPackBatchTitle[];
+}
+
+export interface HacBrewPackBatchResult {
+  stdout: string;
+  stderr: string;
+  exitCode: number;
+  /**
+   * in the same order as the titles, empty if the batch failed
+   */
+  nsps: File[];
+}
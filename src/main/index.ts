@@ -172,6 +172,20 @@ const mainChannelImpl = {
   nandDeleteEntry: async (pathInNand: string) => explorerController.call('del', pathInNand),
   nandFormatPartition: async (partName: string, readonly: boolean, keys?: ProdKeys) =>
     explorerController.call('format', partName, readonly, keys),
+  nandExportPartition: async (partName: string, keys?: ProdKeys) => {
+    const result = await dialog.showSaveDialog(mainWindow, { defaultPath: `${partName}.img` });
+    if (result.canceled) return;
+
+    return explorerController.call('exportPartition', partName, result.filePath, 'sha256', keys);
+  },
+  nandImportPartition: async (partName: string, readonly: boolean, keys?: ProdKeys) => {
+    const result = await dialog.showOpenDialog(mainWindow, { properties: ['openFile'] });
+    if (result.canceled) return;
+
+    return explorerController.call('importPartition', partName, result.filePaths[0], readonly, 'sha256', keys);
+  },
+  nandChecksumPartition: async (partName: string, keys?: ProdKeys) =>
+    explorerController.call('checksumPartition', partName, 'sha256', keys),
 } satisfies PromiseIpc;
 export type MainIpcDefinition = typeof mainChannelImpl;
 
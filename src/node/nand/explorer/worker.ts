@@ -14,7 +14,7 @@ import { NandResult, Partition, ProdKeys } from '../../../channels';
 import prettyBytes from 'pretty-bytes';
 import { BiosParameterBlock } from '../fatfs/bpb';
 import { Crypto, NxCrypto } from '../fatfs/crypto';
-import { Xtsn } from '../xtsn';
+import { ImageChecksum, ImageOptions, Xtsn } from '../xtsn';
 import { resolveKeys } from '../../keys';
 import { Keys } from '../../keys.types';
 import { checkExistsRecursively, preCopyCheck } from './utils';
@@ -41,21 +41,42 @@ class ExplorerError<T> extends Error {
   }
 }
 
+/**
+ * Decrypted sectors to cache per mounted partition (4MiB worth of 512 byte sectors), and how far to read ahead
+ */
+const CACHE_OPTIONS = { maxSectors: 8192, readAheadSectors: 64 };
+
 class Explorer {
   private io: Io | null = null;
   private fs: Fat32FileSystem | null = null;
+  private diskio: NxDiskIo | null = null;
+  private mounted: string | null = null;
   private isPackaged = false;
 
   async close() {
+    this.unmount();
+
+    if (this.io) {
+      this.io.close();
+      this.io = null;
+    }
+  }
+
+  /**
+   * Close the mounted partition (if any), which flushes any writes still in its cache
+   */
+  private unmount() {
     if (this.fs) {
       this.fs.close();
       this.fs = null;
     }
 
-    if (this.io) {
-      this.io.close();
-      this.io = null;
+    if (this.diskio) {
+      this.diskio.close();
+      this.diskio = null;
     }
+
+    this.mounted = null;
   }
 
   private async operation<T>(op: () => Promise<NandResult<T>>): Promise<NandResult<T>> {
@@ -178,8 +199,7 @@ class Explorer {
         data.push(partition);
       }
 
-      this.fs?.close();
-      this.fs = null;
+      this.unmount();
 
       return {
         type: 'success',
@@ -209,15 +229,21 @@ class Explorer {
       }
 
       const bpb = new BiosParameterBlock(nandIo.read(0, 512));
-      const diskio = new NxDiskIo({ ioLayer: nandIo, readonly });
+      const diskio = new NxDiskIo({ ioLayer: nandIo, readonly, cache: CACHE_OPTIONS });
       const fatFs = await FatFs.create({ diskio });
+      this.diskio?.close();
+      this.diskio = diskio;
       this.fs = new Fat32FileSystem(fatFs, bpb);
+      this.mounted = partName;
 
       return { type: 'success', data: undefined };
     });
   }
 
-  private async _createLayer(partName: string, keysFromUser?: ProdKeys): Promise<[NxPartition, NandIoLayer]> {
+  /**
+   * Find where a partition lives in the NAND, and the cipher for it if it's encrypted
+   */
+  private async _resolvePartition(partName: string, keysFromUser?: ProdKeys) {
     const io = this.getIo();
     const keys = await this.resolveKeys(keysFromUser);
 
@@ -226,20 +252,31 @@ class Explorer {
     const partitionEndOffset = Number(partition.lastLBA + 1n) * BLOCK_SIZE;
 
     const nxPartition = NX_PARTITIONS[partition.type];
-    const { bisKeyId, magicOffset, magicBytes, format } = nxPartition;
+    const { bisKeyId, magicOffset, magicBytes } = nxPartition;
 
+    // PRODINFO's magic is at offset 0, so don't test the offset for truthiness
     const isClearText =
-      magicOffset && magicBytes
+      typeof magicOffset === 'number' && magicBytes
         ? io.read(magicOffset + partitionStartOffset, magicBytes.byteLength).equals(magicBytes)
         : false;
 
-    let crypto: Crypto | undefined = undefined;
+    let xtsn: Xtsn | undefined = undefined;
     if (!isClearText && typeof bisKeyId === 'number') {
       const bisKey = keys.getBisKey(bisKeyId);
-      crypto = new NxCrypto(new Xtsn(bisKey.crypto, bisKey.tweak));
+      xtsn = new Xtsn(bisKey.crypto, bisKey.tweak);
     }
 
-    if (!isFat(format)) {
+    return { io, partition, nxPartition, partitionStartOffset, partitionEndOffset, xtsn };
+  }
+
+  private async _createLayer(partName: string, keysFromUser?: ProdKeys): Promise<[NxPartition, NandIoLayer]> {
+    const { io, partition, nxPartition, partitionStartOffset, partitionEndOffset, xtsn } = await this._resolvePartition(
+      partName,
+      keysFromUser,
+    );
+
+    const crypto: Crypto | undefined = xtsn && new NxCrypto(xtsn);
+    if (!isFat(nxPartition.format)) {
       throw new ExplorerError({
         type: 'failure',
         error: `Unsupported partition format, cannot mount '${partition.name}'`,
@@ -258,6 +295,167 @@ class Explorer {
     ];
   }
 
+  /**
+   * Resolve a partition for one of the bulk image operations, which work on the raw partition rather than
+   * through the mounted filesystem, so if it's the mounted partition it's closed first to flush its cache.
+   * Any other mounted partition is left alone, since its cache never covers this partition's sectors.
+   */
+  private async _prepareImage(partName: string, keysFromUser?: ProdKeys) {
+    const { io, nxPartition, partitionStartOffset, partitionEndOffset, xtsn } = await this._resolvePartition(
+      partName,
+      keysFromUser,
+    );
+
+    if (!io.exportImage || !io.importImage || !io.verify) {
+      throw new ExplorerError({ type: 'failure', error: 'Partition images are not supported for this NAND' });
+    }
+
+    // check the magic if there is one, so the wrong prod.keys are caught before writing anything
+    const { magicOffset, magicBytes } = nxPartition;
+    if (xtsn && io.readInto && typeof magicOffset === 'number' && magicBytes) {
+      const data = Buffer.alloc(magicBytes.byteLength);
+      io.readInto(partitionStartOffset + magicOffset, data, xtsn, magicOffset);
+      if (!data.equals(magicBytes)) {
+        throw new ExplorerError({
+          type: 'failure',
+          error: "Failed to decrypt partition, make sure you're using the right prod.keys file",
+        });
+      }
+    }
+
+    if (this.mounted === partName) {
+      this.unmount();
+    }
+
+    const offset = partitionStartOffset;
+    const length = partitionEndOffset - partitionStartOffset;
+    return { io: io as Required<Io>, offset, length, xtsn };
+  }
+
+  /**
+   * Progress for the bulk image operations, where each pass over the partition counts as a single file
+   */
+  private _imageProgress(path: string, length: number, passes: number) {
+    const progress: Progress = {
+      currentFilePath: path,
+      currentFileSize: length,
+      currentFileOffset: 0,
+
+      totalBytes: length * passes,
+      totalBytesCopied: 0,
+      totalFiles: passes,
+      totalFilesCopied: 0,
+      totalDirectories: 0,
+      totalDirectoriesCopied: 0,
+    };
+
+    const options = (xtsn: Xtsn | undefined, checksum: ImageChecksum): ImageOptions => ({
+      xtsn,
+      checksum,
+      onProgress: (bytesDone) => {
+        progress.currentFileOffset = bytesDone;
+        progress.totalBytesCopied = progress.totalFilesCopied * length + bytesDone;
+        process.parentPort.postMessage({ id: 'progress', progress } satisfies OutgoingMessage);
+      },
+    });
+
+    const nextPass = () => {
+      progress.totalFilesCopied++;
+      progress.currentFileOffset = 0;
+    };
+
+    const done = () => process.parentPort.postMessage({ id: 'progress', progress: null } satisfies OutgoingMessage);
+
+    return { options, nextPass, done };
+  }
+
+  /**
+   * Decrypt a whole partition out to a plain image at `destPath`, resolving to the image's checksum
+   */
+  public async exportPartition(
+    partName: string,
+    destPath: string,
+    checksum: ImageChecksum = 'sha256',
+    keysFromUser?: ProdKeys,
+  ): Promise<NandResult<string>> {
+    return this.operation(async () => {
+      const { io, offset, length, xtsn } = await this._prepareImage(partName, keysFromUser);
+      const { options, done } = this._imageProgress(destPath, length, 1);
+
+      try {
+        const data = await io.exportImage(destPath, offset, length, options(xtsn, checksum));
+        return { type: 'success', data };
+      } finally {
+        done();
+      }
+    });
+  }
+
+  /**
+   * Encrypt the plain image at `srcPath` back over a whole partition, then read the partition back to check
+   * it was written correctly, resolving to the image's checksum
+   */
+  public async importPartition(
+    partName: string,
+    srcPath: string,
+    readonly: boolean,
+    checksum: ImageChecksum = 'sha256',
+    keysFromUser?: ProdKeys,
+  ): Promise<NandResult<string>> {
+    return this.operation(async () => {
+      if (readonly) {
+        throw new ReadonlyError();
+      }
+
+      const { io, offset, length, xtsn } = await this._prepareImage(partName, keysFromUser);
+      const stats = await fsp.stat(srcPath);
+      if (stats.size !== length) {
+        throw new ExplorerError({
+          type: 'failure',
+          error: `The image is ${prettyBytes(stats.size)}, but partition '${partName}' is ${prettyBytes(length)}`,
+        });
+      }
+
+      const { options, nextPass, done } = this._imageProgress(srcPath, length, 2);
+      try {
+        const written = await io.importImage(srcPath, offset, length, options(xtsn, checksum));
+        nextPass();
+        const verified = await io.verify(offset, length, options(xtsn, checksum));
+        if (written !== verified) {
+          throw new ExplorerError({
+            type: 'failure',
+            error: `Partition '${partName}' doesn't match the image after writing it (${checksum} ${verified})`,
+          });
+        }
+
+        return { type: 'success', data: written };
+      } finally {
+        done();
+      }
+    });
+  }
+
+  /**
+   * Checksum the plain contents of a whole partition, to compare against an exported image
+   */
+  public async checksumPartition(
+    partName: string,
+    checksum: ImageChecksum = 'sha256',
+    keysFromUser?: ProdKeys,
+  ): Promise<NandResult<string>> {
+    return this.operation(async () => {
+      const { io, offset, length, xtsn } = await this._prepareImage(partName, keysFromUser);
+      const { options, done } = this._imageProgress(partName, length, 1);
+
+      try {
+        const data = await io.verify(offset, length, options(xtsn, checksum));
+        return { type: 'success', data };
+      } finally {
+        done();
+      }
+    });
+  }
+
   public async readdir(fsPath: string): Promise<NandResult<FSEntry[]>> {
     return this.operation(async () => {
       const fs = this.getFat();
@@ -0,0 +1,130 @@
+import { describe, expect, test } from 'vitest';
+import { SectorCache } from './cache';
+import { SECTOR_SIZE, XorOffsetCrypto, getLayer } from './layer.test.util';
+
+const SECTORS = 32;
+
+const createDisk = () => {
+  const disk = Buffer.alloc(SECTOR_SIZE * SECTORS);
+  for (let i = 0; i < SECTORS; i++) disk.fill(i, i * SECTOR_SIZE, (i + 1) * SECTOR_SIZE);
+  return disk;
+};
+
+const sectorOf = (value: number, count = 1) => [...Buffer.alloc(SECTOR_SIZE * count, value)];
+
+describe(SectorCache.name, () => {
+  test('reads hit the cache after the first read', () => {
+    const cache = new SectorCache(getLayer(createDisk()), { maxSectors: 8 });
+    const target = Buffer.alloc(SECTOR_SIZE * 2);
+
+    cache.read(target, 3, 2);
+    expect([...target]).toEqual([...sectorOf(3), ...sectorOf(4)]);
+    expect(cache.stats).toEqual({ hits: 0, misses: 2, evictions: 0, flushes: 0 });
+
+    target.fill(0);
+    cache.read(target, 3, 2);
+    expect([...target]).toEqual([...sectorOf(3), ...sectorOf(4)]);
+    expect(cache.stats).toEqual({ hits: 2, misses: 2, evictions: 0, flushes: 0 });
+  });
+
+  test('reads are decrypted before they are cached', () => {
+    const disk = Buffer.alloc(SECTOR_SIZE * SECTORS);
+    const crypto = new XorOffsetCrypto();
+    disk.set(crypto.encrypt(Buffer.alloc(SECTOR_SIZE, 42), SECTOR_SIZE * 2), SECTOR_SIZE * 2);
+    const cache = new SectorCache(getLayer(disk, crypto), { maxSectors: 8 });
+
+    const target = Buffer.alloc(SECTOR_SIZE);
+    cache.read(target, 2, 1);
+    cache.read(target, 2, 1);
+    expect([...target]).toEqual(sectorOf(42));
+    expect(cache.stats.hits).toBe(1);
+  });
+
+  test('writes are held until flushed', () => {
+    const disk = createDisk();
+    const cache = new SectorCache(getLayer(disk), { maxSectors: 8 });
+
+    cache.write(Buffer.alloc(SECTOR_SIZE * 2, 0xff), 5, 2);
+    expect([...disk.subarray(SECTOR_SIZE * 5, SECTOR_SIZE * 7)]).toEqual([...sectorOf(5), ...sectorOf(6)]);
+
+    // reads see the pending write
+    const target = Buffer.alloc(SECTOR_SIZE);
+    cache.read(target, 6, 1);
+    expect([...target]).toEqual(sectorOf(0xff));
+
+    cache.flush();
+    expect([...disk.subarray(SECTOR_SIZE * 5, SECTOR_SIZE * 7)]).toEqual(sectorOf(0xff, 2));
+    expect(cache.stats.flushes).toBe(2);
+
+    // nothing left to flush
+    cache.flush();
+    expect(cache.stats.flushes).toBe(2);
+  });
+
+  test('evicting a dirty sector writes it back', () => {
+    const disk = createDisk();
+    const cache = new SectorCache(getLayer(disk), { maxSectors: 2 });
+
+    cache.write(Buffer.alloc(SECTOR_SIZE, 0xff), 0, 1);
+    cache.read(Buffer.alloc(SECTOR_SIZE), 1, 1);
+    cache.read(Buffer.alloc(SECTOR_SIZE), 2, 1);
+
+    expect(cache.stats.evictions).toBe(1);
+    expect(cache.stats.flushes).toBe(1);
+    expect([...disk.subarray(0, SECTOR_SIZE)]).toEqual(sectorOf(0xff));
+  });
+
+  test('least recently used sectors are evicted first', () => {
+    const cache = new SectorCache(getLayer(createDisk()), { maxSectors: 2 });
+    const target = Buffer.alloc(SECTOR_SIZE);
+
+    cache.read(target, 0, 1);
+    cache.read(target, 1, 1);
+    cache.read(target, 0, 1);
+    cache.read(target, 2, 1);
+
+    // sector 1 was evicted, but 0 is still cached
+    cache.read(target, 0, 1);
+    expect(cache.stats).toEqual({ hits: 2, misses: 3, evictions: 1, flushes: 0 });
+  });
+
+  test('sequential reads read ahead', () => {
+    const cache = new SectorCache(getLayer(createDisk()), { maxSectors: 16, readAheadSectors: 4 });
+    const target = Buffer.alloc(SECTOR_SIZE);
+
+    cache.read(target, 0, 1);
+    cache.read(target, 1, 1);
+    expect(cache.stats.misses).toBe(2);
+
+    // the second read was sequential, so 2..5 should now be cached
+    for (let i = 2; i < 6; i++) {
+      cache.read(target, i, 1);
+      expect([...target]).toEqual(sectorOf(i));
+    }
+
+    expect(cache.stats).toEqual({ hits: 4, misses: 2, evictions: 0, flushes: 0 });
+  });
+
+  test('large writes go straight to disk and replace cached sectors', () => {
+    const disk = createDisk();
+    const cache = new SectorCache(getLayer(disk), { maxSectors: 4 });
+
+    cache.write(Buffer.alloc(SECTOR_SIZE, 0xaa), 1, 1);
+    cache.write(Buffer.alloc(SECTOR_SIZE * 8, 0xbb), 0, 8);
+    expect([...disk.subarray(0, SECTOR_SIZE * 8)]).toEqual(sectorOf(0xbb, 8));
+
+    // the older cached write must not be flushed over the top
+    cache.flush();
+    expect([...disk.subarray(SECTOR_SIZE, SECTOR_SIZE * 2)]).toEqual(sectorOf(0xbb));
+  });
+
+  test('large reads see pending writes', () => {
+    const cache = new SectorCache(getLayer(createDisk()), { maxSectors: 4 });
+    cache.write(Buffer.alloc(SECTOR_SIZE, 0xff), 2, 1);
+
+    const target = Buffer.alloc(SECTOR_SIZE * 8);
+    cache.read(target, 0, 8);
+    expect([...target.subarray(SECTOR_SIZE * 2, SECTOR_SIZE * 3)]).toEqual(sectorOf(0xff));
+    expect([...target.subarray(SECTOR_SIZE * 3, SECTOR_SIZE * 4)]).toEqual(sectorOf(3));
+  });
+});
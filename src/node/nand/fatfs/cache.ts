@@ -0,0 +1,262 @@
+import { NandIoLayer } from './layer';
+
+export interface SectorCacheOptions {
+  /**
+   * Maximum number of (decrypted) sectors to keep in memory
+   */
+  maxSectors: number;
+  /**
+   * How many extra sectors to read when reads look sequential, `0` disables read-ahead
+   */
+  readAheadSectors?: number;
+}
+
+export interface SectorCacheStats {
+  /** number of sectors read from the cache */
+  hits: number;
+  /** number of sectors which had to be read from disk */
+  misses: number;
+  /** number of sectors dropped from the cache to make room for others */
+  evictions: number;
+  /** number of dirty sectors written back to disk */
+  flushes: number;
+}
+
+/**
+ * A bounded write-back cache of decrypted sectors, which sits between FatFs
+ * and the `NandIoLayer`. FatFs re-reads the same FAT and directory sectors
+ * constantly, so this saves both the syscalls and the crypto for those.
+ *
+ * Written sectors are kept in memory and marked dirty until `flush` is
+ * called (FatFs requests this via `CTRL_SYNC` at the end of each operation),
+ * or until they're evicted. Very large reads and writes skip the cache so that
+ * bulk file data doesn't push out the metadata.
+ */
+export class SectorCache {
+  private readonly sectorSize: number;
+  private readonly sectorCount: number;
+  private readonly maxSectors: number;
+  private readonly readAheadSectors: number;
+  private readonly bypassSectors: number;
+
+  /** storage for every cached sector, so we never allocate per sector */
+  private readonly slab: Buffer;
+  /** sector -> slot in `slab`, in least to most recently used order */
+  private readonly slots = new Map<number, number>();
+  private readonly freeSlots: number[] = [];
+  private readonly dirty = new Set<number>();
+
+  /** where the next read would start if reads were sequential */
+  private nextSequentialSector = -1;
+  private scratch = Buffer.alloc(0);
+
+  public readonly stats: SectorCacheStats = { hits: 0, misses: 0, evictions: 0, flushes: 0 };
+
+  constructor(
+    private readonly ioLayer: NandIoLayer,
+    options: SectorCacheOptions,
+  ) {
+    this.sectorSize = ioLayer.sectorSize;
+    this.sectorCount = ioLayer.sectorCount;
+    this.maxSectors = Math.max(1, options.maxSectors);
+    this.readAheadSectors = options.readAheadSectors ?? 0;
+    this.bypassSectors = Math.max(1, Math.floor(this.maxSectors / 2));
+
+    this.slab = Buffer.alloc(this.maxSectors * this.sectorSize);
+    for (let i = this.maxSectors - 1; i >= 0; i--) {
+      this.freeSlots.push(i);
+    }
+  }
+
+  public read(target: Uint8Array, sector: number, count: number) {
+    const sequential = sector === this.nextSequentialSector;
+    this.nextSequentialSector = sector + count;
+
+    if (count > this.bypassSectors) {
+      this.ioLayer.readInto(sector * this.sectorSize, target.subarray(0, count * this.sectorSize));
+      // anything we have cached is at least as new as what's on disk
+      for (let i = 0; i < count; i++) {
+        const slot = this.slots.get(sector + i);
+        if (slot !== undefined) {
+          target.set(this.slotData(slot), i * this.sectorSize);
+        }
+      }
+
+      this.stats.misses += count;
+      return;
+    }
+
+    let i = 0;
+    while (i < count) {
+      const slot = this.touch(sector + i);
+      if (slot !== undefined) {
+        target.set(this.slotData(slot), i * this.sectorSize);
+        this.stats.hits++;
+        i++;
+        continue;
+      }
+
+      // find the run of sectors that need to be read from disk
+      let missEnd = i + 1;
+      while (missEnd < count && !this.slots.has(sector + missEnd)) {
+        missEnd++;
+      }
+
+      this.stats.misses += missEnd - i;
+      this.fill(target, sector, i, missEnd, sequential && missEnd === count);
+      i = missEnd;
+    }
+  }
+
+  public write(source: Uint8Array, sector: number, count: number) {
+    if (count > this.bypassSectors) {
+      // write straight through, and drop any stale copies we have
+      for (let i = 0; i < count; i++) {
+        this.drop(sector + i);
+      }
+
+      this.ioLayer.write(sector * this.sectorSize, source.subarray(0, count * this.sectorSize));
+      return;
+    }
+
+    for (let i = 0; i < count; i++) {
+      const slot = this.allocate(sector + i);
+      const start = i * this.sectorSize;
+      this.slab.set(source.subarray(start, start + this.sectorSize), slot * this.sectorSize);
+      this.dirty.add(sector + i);
+    }
+  }
+
+  /**
+   * Write all dirty sectors back to disk, coalescing neighbouring sectors into single writes.
+   */
+  public flush() {
+    if (this.dirty.size === 0) {
+      return;
+    }
+
+    const sectors = [...this.dirty].sort((a, b) => a - b);
+    let start = 0;
+    while (start < sectors.length) {
+      let end = start + 1;
+      while (end < sectors.length && sectors[end] === sectors[end - 1] + 1) {
+        end++;
+      }
+
+      const runLength = end - start;
+      if (runLength === 1) {
+        this.ioLayer.write(sectors[start] * this.sectorSize, this.slotData(this.slots.get(sectors[start]) as number));
+      } else {
+        const buf = this.getScratch(runLength);
+        for (let i = 0; i < runLength; i++) {
+          buf.set(this.slotData(this.slots.get(sectors[start + i]) as number), i * this.sectorSize);
+        }
+
+        this.ioLayer.write(sectors[start] * this.sectorSize, buf);
+      }
+
+      this.stats.flushes += runLength;
+      start = end;
+    }
+
+    this.dirty.clear();
+  }
+
+  /**
+   * Read sectors `[start, end)` of the request from disk into both `target` and the cache.
+   */
+  private fill(target: Uint8Array, sector: number, start: number, end: number, readAhead: boolean) {
+    let extra = 0;
+    if (readAhead) {
+      const limit = Math.min(this.readAheadSectors, this.sectorCount - (sector + end), this.bypassSectors - end);
+      while (extra < limit && !this.slots.has(sector + end + extra)) {
+        extra++;
+      }
+    }
+
+    const offset = (sector + start) * this.sectorSize;
+    if (extra === 0) {
+      // read directly into the target, then keep a copy
+      const dest = target.subarray(start * this.sectorSize, end * this.sectorSize);
+      this.ioLayer.readInto(offset, dest);
+      for (let i = 0; i < end - start; i++) {
+        const slot = this.allocate(sector + start + i);
+        this.slab.set(dest.subarray(i * this.sectorSize, (i + 1) * this.sectorSize), slot * this.sectorSize);
+      }
+
+      return;
+    }
+
+    const runLength = end - start + extra;
+    const buf = this.getScratch(runLength);
+    this.ioLayer.readInto(offset, buf);
+    target.set(buf.subarray(0, (end - start) * this.sectorSize), start * this.sectorSize);
+    for (let i = 0; i < runLength; i++) {
+      const slot = this.allocate(sector + start + i);
+      this.slab.set(buf.subarray(i * this.sectorSize, (i + 1) * this.sectorSize), slot * this.sectorSize);
+    }
+  }
+
+  /**
+   * If the sector is cached, mark it as most recently used and return its slot.
+   */
+  private touch(sector: number): number | undefined {
+    const slot = this.slots.get(sector);
+    if (slot !== undefined) {
+      this.slots.delete(sector);
+      this.slots.set(sector, slot);
+    }
+
+    return slot;
+  }
+
+  private allocate(sector: number): number {
+    const existing = this.touch(sector);
+    if (existing !== undefined) {
+      return existing;
+    }
+
+    if (this.freeSlots.length === 0) {
+      this.evict();
+    }
+
+    const slot = this.freeSlots.pop() as number;
+    this.slots.set(sector, slot);
+    return slot;
+  }
+
+  private evict() {
+    const [sector, slot] = this.slots.entries().next().value as [number, number];
+    if (this.dirty.has(sector)) {
+      this.ioLayer.write(sector * this.sectorSize, this.slotData(slot));
+      this.dirty.delete(sector);
+      this.stats.flushes++;
+    }
+
+    this.slots.delete(sector);
+    this.freeSlots.push(slot);
+    this.stats.evictions++;
+  }
+
+  private drop(sector: number) {
+    const slot = this.slots.get(sector);
+    if (slot !== undefined) {
+      this.slots.delete(sector);
+      this.dirty.delete(sector);
+      this.freeSlots.push(slot);
+    }
+  }
+
+  private slotData(slot: number): Buffer {
+    return this.slab.subarray(slot * this.sectorSize, (slot + 1) * this.sectorSize);
+  }
+
+  private getScratch(sectors: number): Buffer {
+    const size = sectors * this.sectorSize;
+    if (this.scratch.byteLength < size) {
+      this.scratch = Buffer.alloc(size);
+    }
+
+    return this.scratch.subarray(0, size);
+  }
+}
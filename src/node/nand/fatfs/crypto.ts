@@ -8,7 +8,7 @@ export interface Crypto {
 }
 
 export class NxCrypto implements Crypto {
-  constructor(private readonly xtsn: Xtsn) {}
+  constructor(public readonly xtsn: Xtsn) {}
 
   blockSize(): number {
     // algorithm is aes-128-ecb (the '128' is 128 bits, thus 16 bytes)
@@ -77,4 +77,22 @@ describe(NxDiskIo.name, () => {
     // also verify nothing was written to disk
     expect([...disk]).toEqual([...Buffer.alloc(128, 0)]);
   });
+
+  test('cached writes are flushed on CTRL_SYNC', () => {
+    const disk = Buffer.alloc(256, 0);
+    const diskio = new NxDiskIo({ readonly: false, ioLayer: getLayer(disk), cache: { maxSectors: 4 } });
+
+    const ff = mockFatFs();
+    ff.HEAPU8.set(Buffer.alloc(SECTOR_SIZE, 0xff));
+
+    // the write is held in the cache, but is visible to reads
+    diskio.write(ff, 0, 0, 1, 1);
+    expect([...disk]).toEqual([...Buffer.alloc(256, 0)]);
+    diskio.read(ff, 0, 512, 1, 1);
+    expect([...ff.HEAPU8.subarray(512, 512 + SECTOR_SIZE)]).toEqual([...Buffer.alloc(SECTOR_SIZE, 0xff)]);
+
+    expect(diskio.ioctl(ff, 0, FatFs.CTRL_SYNC, 0)).toBe(FatFs.RES_OK);
+    expect([...disk.subarray(SECTOR_SIZE, SECTOR_SIZE * 2)]).toEqual([...Buffer.alloc(SECTOR_SIZE, 0xff)]);
+    expect(diskio.cacheStats()).toEqual({ hits: 1, misses: 0, evictions: 0, flushes: 1 });
+  });
 });
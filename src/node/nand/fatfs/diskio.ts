@@ -1,5 +1,6 @@
 import * as FatFs from 'js-fatfs';
 import { NandIoLayer } from './layer';
+import { SectorCache, SectorCacheOptions, SectorCacheStats } from './cache';
 
 export interface PartitionDriverOptions {
   ioLayer: NandIoLayer;
@@ -7,6 +8,10 @@ export interface PartitionDriverOptions {
    * Whether or not to treat the disk as readonly
    */
   readonly: boolean;
+  /**
+   * If set, decrypted sectors are cached and writes are held until FatFs asks for a sync
+   */
+  cache?: SectorCacheOptions;
 }
 
 export class ReadonlyError extends Error {}
@@ -18,13 +23,30 @@ export class NxDiskIo implements FatFs.DiskIO {
   private readonly sectorCount: number;
   private readonly ioLayer: NandIoLayer;
   private readonly readonly: boolean;
+  private readonly cache?: SectorCache;
 
-  constructor({ readonly, ioLayer }: PartitionDriverOptions) {
+  constructor({ readonly, ioLayer, cache }: PartitionDriverOptions) {
     this.readonly = readonly;
     this.ioLayer = ioLayer;
     this.blockSize = ioLayer.blockSize;
     this.sectorSize = ioLayer.sectorSize;
     this.sectorCount = ioLayer.sectorCount;
+    this.cache = cache ? new SectorCache(ioLayer, cache) : undefined;
+  }
+
+  /**
+   * Write any cached sectors back to disk
+   */
+  flush() {
+    this.cache?.flush();
+  }
+
+  close() {
+    this.flush();
+  }
+
+  cacheStats(): SectorCacheStats | undefined {
+    return this.cache?.stats;
   }
 
   initialize(_ff: FatFs.FatFs, _pdrv: number) {
@@ -42,7 +64,14 @@ export class NxDiskIo implements FatFs.DiskIO {
     const end = (sector + count) * this.sectorSize;
     const size = end - start;
 
-    ff.HEAPU8.set(this.ioLayer.read(start, size), buff);
+    // read straight into the WASM heap, so there's no intermediate copy
+    const target = ff.HEAPU8.subarray(buff, buff + size);
+    if (this.cache) {
+      this.cache.read(target, sector, count);
+    } else {
+      this.ioLayer.readInto(start, target);
+    }
+
     return FatFs.RES_OK;
   }
 
@@ -52,13 +81,19 @@ export class NxDiskIo implements FatFs.DiskIO {
     }
 
     const bytesToWrite = new Uint8Array(ff.HEAPU8.buffer, buff, count * this.sectorSize);
-    this.ioLayer.write(sector * this.sectorSize, bytesToWrite);
+    if (this.cache) {
+      this.cache.write(bytesToWrite, sector, count);
+    } else {
+      this.ioLayer.write(sector * this.sectorSize, bytesToWrite);
+    }
+
     return FatFs.RES_OK;
   }
 
   ioctl(ff: FatFs.FatFs, _pdrv: number, cmd: number, buff: number): number {
     switch (cmd) {
       case FatFs.CTRL_SYNC:
+        this.flush();
         return FatFs.RES_OK;
       case FatFs.GET_SECTOR_COUNT:
         ff.setValue(buff, this.sectorCount, 'i32');
@@ -2,7 +2,8 @@ import { stat, readFile, writeFile, readdir } from 'node:fs/promises';
 import path from 'node:path';
 import { describe, expect, test } from 'vitest';
 import { temporaryWriteTask, temporaryDirectoryTask } from 'tempy';
-import { CombinedDumpIo, SplitDumpIo } from './io';
+import { CombinedDumpIo, NativeDumpIo, SplitDumpIo } from './io';
+import { Xtsn } from '../xtsn';
 
 describe(CombinedDumpIo.name, () => {
   test('size', () => {
@@ -192,3 +193,90 @@ describe(SplitDumpIo.name, () => {
     });
   });
 });
+
+describe(NativeDumpIo.name, () => {
+  const getFiles = async (dirPath: string) => {
+    await writeFile(path.join(dirPath, 'file.00'), Buffer.alloc(16, 0));
+    await writeFile(path.join(dirPath, 'file.01'), Buffer.alloc(16, 1));
+    await writeFile(path.join(dirPath, 'file.02'), Buffer.alloc(16, 2));
+
+    return await readdir(dirPath).then((names) => names.map((n) => path.join(dirPath, n)).sort());
+  };
+
+  test('size', () => {
+    return temporaryDirectoryTask<void>(async (dirPath) => {
+      const io = new NativeDumpIo(await getFiles(dirPath));
+      expect(io.size()).toBe(48);
+      io.close();
+    });
+  });
+
+  test('read over boundaries and end', () => {
+    return temporaryDirectoryTask<void>(async (dirPath) => {
+      const io = new NativeDumpIo(await getFiles(dirPath));
+      expect([...io.read(8, 1000)]).toEqual([...Buffer.alloc(8, 0), ...Buffer.alloc(16, 1), ...Buffer.alloc(16, 2)]);
+      expect([...io.read(100, 10)]).toEqual([]);
+      io.close();
+    });
+  });
+
+  test('write over boundaries and end', () => {
+    return temporaryDirectoryTask<void>(async (dirPath) => {
+      const files = await getFiles(dirPath);
+      const io = new NativeDumpIo(files);
+      expect(io.write(8, Buffer.alloc(100, 42))).toBe(40);
+      expect(io.write(100, Buffer.alloc(10))).toBe(0);
+      expect([...(await readFile(files[0]))]).toEqual([...Buffer.alloc(8, 0), ...Buffer.alloc(8, 42)]);
+      expect([...(await readFile(files[1]))]).toEqual([...Buffer.alloc(16, 42)]);
+      expect([...(await readFile(files[2]))]).toEqual([...Buffer.alloc(16, 42)]);
+      io.close();
+    });
+  });
+
+  test('single file read over and past end', () => {
+    return temporaryWriteTask<void>(Buffer.alloc(10, 42), async (filePath) => {
+      const io = new NativeDumpIo([filePath]);
+      expect(io.size()).toBe(10);
+      expect([...io.read(0, 100)]).toEqual([...(await readFile(filePath))]);
+      expect([...io.read(100, 10)]).toEqual([]);
+      io.close();
+    });
+  });
+
+  test('single file write over and past end', () => {
+    return temporaryWriteTask<void>(Buffer.alloc(10), async (filePath) => {
+      const io = new NativeDumpIo([filePath]);
+      expect(io.write(0, Buffer.alloc(20, 1))).toBe(10);
+      expect(io.write(100, Buffer.alloc(10))).toBe(0);
+      expect([...(await readFile(filePath))]).toEqual([...Buffer.alloc(10, 1)]);
+      io.close();
+    });
+  });
+
+  test('unaligned crypto reads and writes', () => {
+    const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2));
+    const partitionStart = 0x4000;
+    const disk = Buffer.concat([Buffer.alloc(partitionStart), xtsn.encrypt(Buffer.alloc(0x4000 * 3))]);
+
+    return temporaryWriteTask<void>(disk, async (filePath) => {
+      const io = new NativeDumpIo([filePath]);
+
+      // write some data which starts and ends part way through a block, and crosses a sector boundary
+      const data = Buffer.alloc(0x4000 + 7, 0x5a);
+      expect(io.writeFrom(partitionStart + 0x3ff3, data, xtsn, 0x3ff3)).toBe(data.byteLength);
+      expect(data.equals(Buffer.alloc(0x4000 + 7, 0x5a))).toBe(true);
+
+      // it should match what the js cipher decrypts
+      const expected = Buffer.alloc(0x4000 * 3);
+      expected.set(data, 0x3ff3);
+      const clear = xtsn.decrypt((await readFile(filePath)).subarray(partitionStart));
+      expect(clear.equals(expected)).toBe(true);
+
+      // and reading it back directly should work the same
+      const target = Buffer.alloc(0x21);
+      expect(io.readInto(partitionStart + 0x3fe5, target, xtsn, 0x3fe5)).toBe(0x21);
+      expect(target.equals(expected.subarray(0x3fe5, 0x3fe5 + 0x21))).toBe(true);
+      io.close();
+    });
+  });
+});
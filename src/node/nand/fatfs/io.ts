@@ -1,6 +1,7 @@
 import { basename, dirname, join } from 'node:path';
 import fs from 'node:fs';
 import fsp from 'node:fs/promises';
+import { ImageOptions, NandDevice, Xtsn } from '../xtsn';
 
 /**
  * The interface for a wrapper around reading disk images.
@@ -12,6 +13,28 @@ export interface Io {
   size(): number;
   read(offset: number, length: number): Buffer;
   write(offset: number, data: Buffer): number;
+
+  /**
+   * Optional fast path which reads directly into `target` rather than allocating,
+   * and decrypts in the same step if `xtsn` is provided.
+   * @param cryptoOffset the byte offset passed to the cipher
+   */
+  readInto?(offset: number, target: Uint8Array, xtsn?: Xtsn, cryptoOffset?: number): number;
+
+  /**
+   * Optional fast path which writes `source` (encrypting it if `xtsn` is provided)
+   * without modifying it, handling writes that aren't aligned to cipher blocks.
+   * @param cryptoOffset the byte offset passed to the cipher
+   */
+  writeFrom?(offset: number, source: Uint8Array, xtsn?: Xtsn, cryptoOffset?: number): number;
+
+  /**
+   * Optional bulk paths which copy a whole partition to or from a plain image file (or just checksum it)
+   * off the JS thread. They resolve to the checksum of the plain data.
+   */
+  exportImage?(path: string, offset: number, length: number, options?: ImageOptions): Promise<string>;
+  importImage?(path: string, offset: number, length: number, options?: ImageOptions): Promise<string>;
+  verify?(offset: number, length: number, options?: ImageOptions): Promise<string>;
 }
 
 export async function createIo(nandPath: string): Promise<Io> {
@@ -21,15 +44,71 @@ export async function createIo(nandPath: string): Promise<Io> {
     const dir = dirname(nandPath);
     const prefix = basename(nandPath).slice(0, -splitFileSuffix.length);
     const entries = await fsp.readdir(dir);
-    return new SplitDumpIo(
-      entries
-        .filter((name) => name.startsWith(prefix) && /\.\d\d$/.test(name))
-        .map((name) => join(dir, name))
-        .sort(),
-    );
+    const parts = entries
+      .filter((name) => name.startsWith(prefix) && /\.\d\d$/.test(name))
+      .map((name) => join(dir, name))
+      .sort();
+
+    // fall back to plain file IO if the addon doesn't have the native device
+    return NandDevice.isSupported() ? new NativeDumpIo(parts) : new SplitDumpIo(parts);
+  }
+
+  return NandDevice.isSupported() ? new NativeDumpIo([nandPath]) : new CombinedDumpIo(nandPath);
+}
+
+/**
+ * IO implementation for both combined and split NAND dumps, which is backed by
+ * a native device that owns the file descriptors. Unlike the fallback
+ * implementations, this supports the `readInto` and `writeFrom` fast paths, and the bulk image paths.
+ */
+export class NativeDumpIo implements Io {
+  private readonly device: NandDevice;
+
+  constructor(parts: string[]) {
+    this.device = new NandDevice(parts);
   }
 
-  return new CombinedDumpIo(nandPath);
+  close() {
+    this.device.close();
+  }
+
+  size(): number {
+    return this.device.size();
+  }
+
+  read(offset: number, length: number): Buffer {
+    const readSize = Math.min(this.size() - offset, length);
+    if (readSize <= 0) {
+      return Buffer.alloc(0);
+    }
+
+    const buf = Buffer.alloc(readSize);
+    return buf.subarray(0, this.device.read(offset, buf));
+  }
+
+  write(offset: number, data: Buffer): number {
+    return this.device.write(offset, data);
+  }
+
+  readInto(offset: number, target: Uint8Array, xtsn?: Xtsn, cryptoOffset?: number): number {
+    return this.device.read(offset, target, xtsn, cryptoOffset);
+  }
+
+  writeFrom(offset: number, source: Uint8Array, xtsn?: Xtsn, cryptoOffset?: number): number {
+    return this.device.write(offset, source, xtsn, cryptoOffset);
+  }
+
+  exportImage(path: string, offset: number, length: number, options?: ImageOptions): Promise<string> {
+    return this.device.exportImage(path, offset, length, options);
+  }
+
+  importImage(path: string, offset: number, length: number, options?: ImageOptions): Promise<string> {
+    return this.device.importImage(path, offset, length, options);
+  }
+
+  verify(offset: number, length: number, options?: ImageOptions): Promise<string> {
+    return this.device.verify(offset, length, options);
+  }
 }
 
 /**
@@ -1,5 +1,6 @@
-import { Crypto } from './crypto';
+import { Crypto, NxCrypto } from './crypto';
 import { Io } from './io';
+import { Xtsn } from '../xtsn';
 
 export interface NandIoOptions {
   io: Io;
@@ -19,6 +20,8 @@ export class NandIoLayer {
   private readonly partitionStartOffset: number;
   private readonly partitionEndOffset: number;
   private readonly crypto?: Crypto;
+  /** set when the io and crypto both support the native zero-copy fast paths */
+  private readonly native?: { io: Required<Io>; xtsn?: Xtsn };
 
   public readonly blockSize: number;
   public readonly sectorSize: number;
@@ -33,6 +36,32 @@ export class NandIoLayer {
     this.blockSize = options.crypto?.blockSize() ?? 16;
     this.sectorSize = options.sectorSize;
     this.sectorCount = Math.floor((options.partitionEndOffset - options.partitionStartOffset) / options.sectorSize);
+
+    const { io, crypto } = options;
+    if (io.readInto && io.writeFrom && (!crypto || crypto instanceof NxCrypto)) {
+      this.native = { io: io as Required<Io>, xtsn: crypto?.xtsn };
+    }
+  }
+
+  /**
+   * Read `target.byteLength` bytes into `target`. When the native fast path is
+   * available, this reads and decrypts without any intermediate copies.
+   * @returns the number of bytes read
+   */
+  public readInto(offset: number, target: Uint8Array): number {
+    const size = Math.min(target.byteLength, this.partitionEndOffset - this.partitionStartOffset - offset);
+    if (size <= 0) {
+      return 0;
+    }
+
+    if (this.native) {
+      const { io, xtsn } = this.native;
+      return io.readInto(this.partitionStartOffset + offset, target.subarray(0, size), xtsn, offset);
+    }
+
+    const buf = this.read(offset, size);
+    target.set(buf);
+    return buf.byteLength;
   }
 
   public read(offset: number, size: number): Buffer {
@@ -48,6 +77,11 @@ export class NandIoLayer {
       size = this.partitionEndOffset - offset;
     }
 
+    if (this.native) {
+      const buf = Buffer.alloc(Math.max(size, 0));
+      return buf.subarray(0, this.readInto(offset, buf));
+    }
+
     if (!this.crypto) {
       return this.io.read(diskOffset, size);
     }
@@ -85,7 +119,12 @@ export class NandIoLayer {
     const diskEndOffset = diskOffset + data.byteLength;
     const excess = diskEndOffset - this.partitionEndOffset;
     if (excess > 0) {
-      data = Buffer.from(data.buffer.slice(0, -excess));
+      data = data.subarray(0, data.byteLength - excess);
+    }
+
+    if (this.native) {
+      const { io, xtsn } = this.native;
+      return io.writeFrom(diskOffset, data, xtsn, offset);
     }
 
     if (!this.crypto) {
@@ -1,23 +1,46 @@
 {
+  "variables": {
+    "build_bench%": 0
+  },
+  "target_defaults": {
+    "include_dirs": [
+      "<!(pkg-config --cflags-only-I openssl | sed 's/-I//g')"
+    ],
+    "libraries": [
+      "<!(pkg-config --libs openssl)"
+    ],
+    "conditions": [
+      ["OS=='mac'", {
+        "libraries": [
+          "<!(sh -c 'echo -L$(pkg-config --variable=libdir openssl)/lib -lssl -lcrypto')"
+        ]
+      }],
+    ]
+  },
   "targets": [
     {
       "target_name": "xtsn",
       "sources": [
-        "native.cc"
-      ],
-      "include_dirs": [
-        "<!(pkg-config --cflags-only-I openssl | sed 's/-I//g')"
-      ],
-      "libraries": [
-        "<!(pkg-config --libs openssl)"
-      ],
-      "conditions": [
-        ["OS=='mac'", {
-          "libraries": [
-            "<!(sh -c 'echo -L$(pkg-config --variable=libdir openssl)/lib -lssl -lcrypto')"
-          ]
-        }],
+        "device.cc",
+        "image.cc",
+        "native.cc",
+        "xts.cc"
       ]
     }
+  ],
+  "conditions": [
+    # only built on request (`GYP_DEFINES=build_bench=1`), see `just bench-native`
+    ["build_bench==1", {
+      "targets": [
+        {
+          "target_name": "xtsn_bench",
+          "type": "executable",
+          "sources": [
+            "bench.cc",
+            "xts.cc"
+          ]
+        }
+      ]
+    }]
   ]
 }
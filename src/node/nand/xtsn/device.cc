@@ -0,0 +1,277 @@
+#include "device.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "xts.h"
+
+namespace xtsn {
+
+/**
+ * Maximum size of a single read or write syscall, since `uv_buf_t` lengths are 32 bit on some platforms
+ */
+constexpr uint64_t kMaxIoSize = 0x40000000;
+
+/**
+ * Size of the scratch buffer used to encrypt data before it's written, since we can't encrypt the source in-place
+ */
+constexpr uint64_t kWriteChunkSize = 0x100000;
+
+void RunCipher(const DeviceCipher *cipher, bool encrypt, unsigned char *data, uint64_t length, uint64_t cryptoOffset) {
+  RunXts(cipher->tweak, encrypt ? cipher->encrypt : cipher->decrypt, data, length, cryptoOffset / cipher->sectorSize,
+         cryptoOffset % cipher->sectorSize, cipher->sectorSize);
+}
+
+NandDevice::NandDevice(std::vector<std::string> paths) : totalSize(0) {
+  for (std::string &path : paths) {
+    files.push_back({path, -1, false, 0, 0});
+  }
+}
+
+NandDevice::~NandDevice() { Close(); }
+
+int NandDevice::Open() {
+  uv_fs_t req;
+  uint64_t offset = 0;
+  for (File &file : files) {
+    int fd = uv_fs_open(nullptr, &req, file.path.c_str(), UV_FS_O_RDONLY, 0, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (fd < 0) {
+      Close();
+      return fd;
+    }
+
+    int result = uv_fs_fstat(nullptr, &req, fd, nullptr);
+    uint64_t size = req.statbuf.st_size;
+    uv_fs_req_cleanup(&req);
+    if (result < 0) {
+      uv_fs_close(nullptr, &req, fd, nullptr);
+      uv_fs_req_cleanup(&req);
+      Close();
+      return result;
+    }
+
+    file.fd = fd;
+    file.writable = false;
+    file.offset = offset;
+    file.length = size;
+    offset += size;
+  }
+
+  totalSize = offset;
+  return 0;
+}
+
+void NandDevice::Close() {
+  uv_fs_t req;
+  for (File &file : files) {
+    if (file.fd >= 0) {
+      uv_fs_close(nullptr, &req, file.fd, nullptr);
+      uv_fs_req_cleanup(&req);
+      file.fd = -1;
+    }
+  }
+}
+
+int NandDevice::MakeWritable(File &file) {
+  if (file.writable)
+    return 0;
+
+  uv_fs_t req;
+  int fd = uv_fs_open(nullptr, &req, file.path.c_str(), UV_FS_O_RDWR, 0, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0)
+    return fd;
+
+  uv_fs_close(nullptr, &req, file.fd, nullptr);
+  uv_fs_req_cleanup(&req);
+
+  file.fd = fd;
+  file.writable = true;
+  return 0;
+}
+
+size_t NandDevice::FindFile(uint64_t offset) const {
+  auto it = std::upper_bound(files.begin(), files.end(), offset,
+                             [](uint64_t offset, const File &file) { return offset < file.offset; });
+  return (it - files.begin()) - 1;
+}
+
+int64_t NandDevice::ReadRaw(uint64_t offset, unsigned char *target, uint64_t length) {
+  if (offset >= totalSize)
+    return 0;
+
+  length = std::min(length, totalSize - offset);
+
+  uv_fs_t req;
+  uint64_t done = 0;
+  for (size_t i = FindFile(offset); done < length && i < files.size(); i++) {
+    File &file = files[i];
+    uint64_t localOffset = offset + done - file.offset;
+    uint64_t end = done + std::min(file.length - localOffset, length - done);
+
+    while (done < end) {
+      uv_buf_t buf = uv_buf_init(reinterpret_cast<char *>(target + done), std::min(end - done, kMaxIoSize));
+      int result = uv_fs_read(nullptr, &req, file.fd, &buf, 1, offset + done - file.offset, nullptr);
+      uv_fs_req_cleanup(&req);
+      if (result < 0)
+        return result;
+      if (result == 0)
+        return done;
+
+      done += result;
+    }
+  }
+
+  return done;
+}
+
+int64_t NandDevice::WriteRaw(uint64_t offset, const unsigned char *source, uint64_t length) {
+  if (offset >= totalSize)
+    return 0;
+
+  length = std::min(length, totalSize - offset);
+
+  uv_fs_t req;
+  uint64_t done = 0;
+  for (size_t i = FindFile(offset); done < length && i < files.size(); i++) {
+    File &file = files[i];
+    int result = MakeWritable(file);
+    if (result < 0)
+      return result;
+
+    uint64_t localOffset = offset + done - file.offset;
+    uint64_t end = done + std::min(file.length - localOffset, length - done);
+
+    while (done < end) {
+      uv_buf_t buf = uv_buf_init(const_cast<char *>(reinterpret_cast<const char *>(source + done)),
+                                 std::min(end - done, kMaxIoSize));
+      result = uv_fs_write(nullptr, &req, file.fd, &buf, 1, offset + done - file.offset, nullptr);
+      uv_fs_req_cleanup(&req);
+      if (result < 0)
+        return result;
+
+      done += result;
+    }
+  }
+
+  return done;
+}
+
+int64_t NandDevice::Read(uint64_t offset, unsigned char *target, uint64_t length, const DeviceCipher *cipher,
+                         uint64_t cryptoOffset) {
+  if (!cipher)
+    return ReadRaw(offset, target, length);
+
+  if (offset >= totalSize)
+    return 0;
+
+  length = std::min(length, totalSize - offset);
+
+  // AES works in 16 byte blocks, so if the read doesn't start or end on a block boundary we need to read and
+  // decrypt the whole block and then copy out the part that was asked for:
+  //  11112222333344xx xx55666677778888
+  //  BBBBBBBBBBBBBB     AAAAAAAAAAAAAA   B = before, A = after
+  // everything in between is read straight into `target` and decrypted in-place
+  unsigned char block[kBlockSize];
+  uint64_t done = 0;
+
+  uint64_t before = cryptoOffset % kBlockSize;
+  if (before) {
+    int64_t result = ReadRaw(offset - before, block, kBlockSize);
+    if (result < 0)
+      return result;
+
+    RunCipher(cipher, false, block, kBlockSize, cryptoOffset - before);
+    done = std::min(kBlockSize - before, length);
+    memcpy(target, block + before, done);
+  }
+
+  uint64_t aligned = (length - done) - (length - done) % kBlockSize;
+  if (aligned) {
+    int64_t result = ReadRaw(offset + done, target + done, aligned);
+    if (result < 0)
+      return result;
+
+    RunCipher(cipher, false, target + done, result, cryptoOffset + done);
+    done += result;
+    if ((uint64_t)result < aligned)
+      return done;
+  }
+
+  if (done < length) {
+    int64_t result = ReadRaw(offset + done, block, kBlockSize);
+    if (result < 0)
+      return result;
+
+    RunCipher(cipher, false, block, kBlockSize, cryptoOffset + done);
+    memcpy(target + done, block, length - done);
+    done = length;
+  }
+
+  return done;
+}
+
+int64_t NandDevice::Write(uint64_t offset, const unsigned char *source, uint64_t length, const DeviceCipher *cipher,
+                          uint64_t cryptoOffset) {
+  if (!cipher)
+    return WriteRaw(offset, source, length);
+
+  if (offset >= totalSize)
+    return 0;
+
+  length = std::min(length, totalSize - offset);
+
+  // partial blocks at either end are read, patched with the new data, and then re-encrypted:
+  //  1111222233334444 5555666677778888
+  //  xxxxxxxxxxxxxxWW WWyyyyyyyyyyyyyy   x = before chunk, y = after chunk, W = data to write
+  auto patchBlock = [&](uint64_t blockOffset, uint64_t start, const unsigned char *data, uint64_t count) -> int64_t {
+    unsigned char block[kBlockSize];
+    int64_t result = ReadRaw(offset + blockOffset - cryptoOffset, block, kBlockSize);
+    if (result < 0)
+      return result;
+
+    RunCipher(cipher, false, block, kBlockSize, blockOffset);
+    memcpy(block + start, data, count);
+    RunCipher(cipher, true, block, kBlockSize, blockOffset);
+    return WriteRaw(offset + blockOffset - cryptoOffset, block, kBlockSize);
+  };
+
+  uint64_t done = 0;
+
+  uint64_t before = cryptoOffset % kBlockSize;
+  if (before) {
+    done = std::min(kBlockSize - before, length);
+    int64_t result = patchBlock(cryptoOffset - before, before, source, done);
+    if (result < 0)
+      return result;
+  }
+
+  thread_local std::vector<unsigned char> scratch(kWriteChunkSize);
+  uint64_t aligned = (length - done) - (length - done) % kBlockSize;
+  for (uint64_t end = done + aligned; done < end;) {
+    uint64_t count = std::min(end - done, kWriteChunkSize);
+    memcpy(scratch.data(), source + done, count);
+    RunCipher(cipher, true, scratch.data(), count, cryptoOffset + done);
+
+    int64_t result = WriteRaw(offset + done, scratch.data(), count);
+    if (result < 0)
+      return result;
+
+    done += result;
+    if ((uint64_t)result < count)
+      return done;
+  }
+
+  if (done < length) {
+    int64_t result = patchBlock(cryptoOffset + done, 0, source + done, length - done);
+    if (result < 0)
+      return result;
+
+    done = length;
+  }
+
+  return done;
+}
+
+} // namespace xtsn
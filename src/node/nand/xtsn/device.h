@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <uv.h>
+#include <vector>
+
+#include <openssl/evp.h>
+
+namespace xtsn {
+
+/**
+ * The contexts needed to run the XTS cipher over a partition. `decrypt` is
+ * needed even when writing, since partial blocks have to be read, modified
+ * and then re-encrypted.
+ */
+struct DeviceCipher {
+  EVP_CIPHER_CTX *tweak;
+  EVP_CIPHER_CTX *encrypt;
+  EVP_CIPHER_CTX *decrypt;
+  uint64_t sectorSize;
+};
+
+/**
+ * A NAND dump on disk, either a single combined file or multiple split files
+ * (`rawnand.bin.00`, `rawnand.bin.01`, ...) which are treated as one device.
+ *
+ * All methods are synchronous and return a negative libuv error code on
+ * failure. Files are opened read-only, and re-opened for writing the first
+ * time they're written to.
+ */
+class NandDevice {
+public:
+  NandDevice(std::vector<std::string> paths);
+  ~NandDevice();
+
+  int Open();
+  void Close();
+  uint64_t Size() const { return totalSize; }
+
+  /**
+   * Read `length` bytes at `offset` into `target`, and if `cipher` is given, decrypt them as if they were at
+   * `cryptoOffset` within the partition. Returns the number of bytes read, which is less than `length` at the
+   * end of the device.
+   */
+  int64_t Read(uint64_t offset, unsigned char *target, uint64_t length, const DeviceCipher *cipher = nullptr,
+               uint64_t cryptoOffset = 0);
+
+  /**
+   * Write `length` bytes from `source` at `offset`, and if `cipher` is given, encrypt them as if they were at
+   * `cryptoOffset` within the partition. `source` is never modified. Returns the number of bytes written,
+   * which is less than `length` at the end of the device.
+   */
+  int64_t Write(uint64_t offset, const unsigned char *source, uint64_t length, const DeviceCipher *cipher = nullptr,
+                uint64_t cryptoOffset = 0);
+
+private:
+  struct File {
+    std::string path;
+    uv_file fd;
+    bool writable;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  std::vector<File> files;
+  uint64_t totalSize;
+
+  int64_t ReadRaw(uint64_t offset, unsigned char *target, uint64_t length);
+  int64_t WriteRaw(uint64_t offset, const unsigned char *source, uint64_t length);
+  int MakeWritable(File &file);
+  size_t FindFile(uint64_t offset) const;
+};
+
+} // namespace xtsn
@@ -0,0 +1,329 @@
+#include "image.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+
+#include "xts.h"
+
+namespace xtsn {
+
+/**
+ * Buffers are aligned to pages, which keeps the cipher and checksums on aligned loads and lets the OS skip a copy
+ */
+constexpr uintptr_t kImageBufferAlignment = 0x1000;
+
+/**
+ * Lookup tables for slice-by-8 CRC32 (the zlib polynomial), which handles 8 bytes per step
+ */
+struct Crc32Table {
+  uint32_t entries[8][256];
+
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      entries[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int slice = 1; slice < 8; slice++)
+        entries[slice][i] = (entries[slice - 1][i] >> 8) ^ entries[0][entries[slice - 1][i] & 0xff];
+    }
+  }
+};
+
+uint32_t UpdateCrc32(uint32_t crc, const unsigned char *data, uint64_t length) {
+  static const Crc32Table table;
+  const auto &t = table.entries;
+
+  crc = ~crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+    uint32_t hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+    crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^ t[3][hi & 0xff] ^
+          t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+  }
+  for (; length > 0; data++, length--)
+    crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+ImageJob::ImageJob(NandDevice &device, ImageOptions options, const DeviceCipher *cipher)
+    : device(device), options(options), encrypted(cipher != nullptr), sectorSize(0), contextsCloned(true), file(-1),
+      sha256(nullptr), crc32(0) {
+  this->options.threads = std::min(std::max(1, options.threads), kMaxImageThreads);
+  if (!cipher)
+    return;
+
+  // each cipher thread gets its own contexts, since OpenSSL contexts can't be shared between threads
+  sectorSize = cipher->sectorSize;
+  for (int i = 0; i < this->options.threads; i++) {
+    EVP_CIPHER_CTX *tweak = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX *crypto = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX *source = options.mode == ImageMode::Import ? cipher->encrypt : cipher->decrypt;
+    // a failed copy would leave a context which quietly produces garbage, so the job refuses to run instead
+    contextsCloned = contextsCloned && tweak && crypto && EVP_CIPHER_CTX_copy(tweak, cipher->tweak) &&
+                     EVP_CIPHER_CTX_copy(crypto, source);
+    tweakContexts.push_back(tweak);
+    cryptoContexts.push_back(crypto);
+  }
+}
+
+ImageJob::~ImageJob() {
+  CloseFile();
+
+  for (EVP_CIPHER_CTX *ctx : tweakContexts)
+    EVP_CIPHER_CTX_free(ctx);
+  for (EVP_CIPHER_CTX *ctx : cryptoContexts)
+    EVP_CIPHER_CTX_free(ctx);
+  if (sha256)
+    EVP_MD_CTX_free(sha256);
+}
+
+int ImageJob::OpenFile() {
+  uv_fs_t req;
+  int flags = options.mode == ImageMode::Export ? UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC : UV_FS_O_RDONLY;
+  int fd = uv_fs_open(nullptr, &req, options.path.c_str(), flags, 0644, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0)
+    return fd;
+
+  file = fd;
+  if (options.mode != ImageMode::Import)
+    return 0;
+
+  int result = uv_fs_fstat(nullptr, &req, fd, nullptr);
+  uint64_t size = req.statbuf.st_size;
+  uv_fs_req_cleanup(&req);
+  if (result < 0)
+    return result;
+
+  return size == options.length ? 0 : UV_EINVAL;
+}
+
+void ImageJob::CloseFile() {
+  if (file < 0)
+    return;
+
+  uv_fs_t req;
+  uv_fs_close(nullptr, &req, file, nullptr);
+  uv_fs_req_cleanup(&req);
+  file = -1;
+}
+
+int ImageJob::ReadFile(Chunk &chunk) {
+  uv_fs_t req;
+  for (uint64_t done = 0; done < chunk.length;) {
+    uv_buf_t buf = uv_buf_init(reinterpret_cast<char *>(chunk.data + done), chunk.length - done);
+    int result = uv_fs_read(nullptr, &req, file, &buf, 1, chunk.position + done, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (result < 0)
+      return result;
+    if (result == 0)
+      return UV_EOF;
+
+    done += result;
+  }
+
+  return 0;
+}
+
+int ImageJob::WriteFile(Chunk &chunk) {
+  uv_fs_t req;
+  for (uint64_t done = 0; done < chunk.length;) {
+    uv_buf_t buf = uv_buf_init(reinterpret_cast<char *>(chunk.data + done), chunk.length - done);
+    int result = uv_fs_write(nullptr, &req, file, &buf, 1, chunk.position + done, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (result < 0)
+      return result;
+
+    done += result;
+  }
+
+  return 0;
+}
+
+int ImageJob::ReadDevice(Chunk &chunk) {
+  int64_t result = device.Read(options.offset + chunk.position, chunk.data, chunk.length);
+  if (result < 0)
+    return result;
+
+  return (uint64_t)result == chunk.length ? 0 : UV_EOF;
+}
+
+int ImageJob::WriteDevice(Chunk &chunk) {
+  int64_t result = device.Write(options.offset + chunk.position, chunk.data, chunk.length);
+  if (result < 0)
+    return result;
+
+  return (uint64_t)result == chunk.length ? 0 : UV_ENOSPC;
+}
+
+int ImageJob::RunCipher(Chunk &chunk, int worker) {
+  RunXts(tweakContexts[worker], cryptoContexts[worker], chunk.data, chunk.length, chunk.position / sectorSize,
+         chunk.position % sectorSize, sectorSize);
+  return 0;
+}
+
+int ImageJob::UpdateChecksum(Chunk &chunk) {
+  if (options.checksum == ImageChecksum::Sha256)
+    EVP_DigestUpdate(sha256, chunk.data, chunk.length);
+  else
+    crc32 = UpdateCrc32(crc32, chunk.data, chunk.length);
+  return 0;
+}
+
+void ImageJob::FinishChecksum() {
+  char hex[EVP_MAX_MD_SIZE * 2 + 1];
+  if (options.checksum == ImageChecksum::Sha256) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    EVP_DigestFinal_ex(sha256, digest, &digestLength);
+    for (unsigned int i = 0; i < digestLength; i++)
+      snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    checksum = hex;
+  } else if (options.checksum == ImageChecksum::Crc32) {
+    snprintf(hex, sizeof(hex), "%08x", crc32);
+    checksum = hex;
+  }
+}
+
+bool ImageJob::Run(std::function<void(uint64_t)> onProgress) {
+  if (!contextsCloned) {
+    error = "failed to set up the cipher";
+    return false;
+  }
+  if (options.offset + options.length > device.Size()) {
+    error = "the partition extends past the end of the NAND";
+    return false;
+  }
+  if (encrypted && (options.length % kBlockSize != 0 || sectorSize % kBlockSize != 0)) {
+    error = "encrypted partitions must be a whole number of cipher blocks";
+    return false;
+  }
+
+  if (options.mode != ImageMode::Verify) {
+    int result = OpenFile();
+    if (result < 0) {
+      error = result == UV_EINVAL ? "the image is not the same size as the partition"
+                                  : std::string("failed to open the image: ") + uv_strerror(result);
+      return false;
+    }
+  }
+
+  if (options.checksum == ImageChecksum::Sha256) {
+    sha256 = EVP_MD_CTX_new();
+    if (!sha256 || !EVP_DigestInit_ex(sha256, EVP_sha256(), nullptr)) {
+      CloseFile();
+      error = "failed to set up the checksum";
+      return false;
+    }
+  }
+
+  // the checksum is always taken of the plain data, so it comes after decrypting and before encrypting
+  Stage read = options.mode == ImageMode::Import
+                   ? Stage{[this](Chunk &chunk, int) { return ReadFile(chunk); }, "read the image", 1, 0}
+                   : Stage{[this](Chunk &chunk, int) { return ReadDevice(chunk); }, "read the NAND", 1, 0};
+  Stage cipher = {[this](Chunk &chunk, int worker) { return RunCipher(chunk, worker); }, "run the cipher",
+                  options.threads, 0};
+  Stage hash = {[this](Chunk &chunk, int) { return UpdateChecksum(chunk); }, "checksum", 1, 0};
+  Stage write = options.mode == ImageMode::Import
+                    ? Stage{[this](Chunk &chunk, int) { return WriteDevice(chunk); }, "write the NAND", 1, 0}
+                    : Stage{[this](Chunk &chunk, int) { return WriteFile(chunk); }, "write the image", 1, 0};
+  bool hasChecksum = options.checksum != ImageChecksum::None;
+
+  std::vector<Stage> stages = {read};
+  if (options.mode == ImageMode::Import && hasChecksum)
+    stages.push_back(hash);
+  if (encrypted)
+    stages.push_back(cipher);
+  if (options.mode != ImageMode::Import && hasChecksum)
+    stages.push_back(hash);
+  if (options.mode != ImageMode::Verify)
+    stages.push_back(write);
+
+  // enough buffers to keep every thread busy, with one more waiting on each side of the cipher
+  size_t numChunks = (encrypted ? options.threads : 0) + stages.size() + 1;
+  uint64_t totalChunks = (options.length + kImageChunkSize - 1) / kImageChunkSize;
+  // every byte is written before it's read, so don't pay to zero the buffers first
+  std::unique_ptr<unsigned char[]> storage(new unsigned char[numChunks * kImageChunkSize + kImageBufferAlignment]);
+  uintptr_t misalignment = reinterpret_cast<uintptr_t>(storage.get()) % kImageBufferAlignment;
+  unsigned char *aligned = storage.get() + (misalignment ? kImageBufferAlignment - misalignment : 0);
+  std::vector<Chunk> chunks(numChunks);
+  for (size_t i = 0; i < numChunks; i++)
+    chunks[i] = {aligned + i * kImageChunkSize, i, 0, 0, 0};
+
+  // every chunk moves through the stages in order, and each stage takes chunks in sequence, so anything that has
+  // to see the data in order (checksums, sequential writes) just needs to run on a single thread
+  std::mutex mutex;
+  std::condition_variable changed;
+  uint64_t bytesDone = 0;
+  bool failed = false;
+
+  auto worker = [&](size_t stageIndex, int workerIndex) {
+    Stage &stage = stages[stageIndex];
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!failed && stage.next < totalChunks) {
+      uint64_t sequence = stage.next++;
+      Chunk &chunk = chunks[sequence % numChunks];
+      changed.wait(lock, [&] { return failed || (chunk.sequence == sequence && chunk.stage == stageIndex); });
+      if (failed)
+        break;
+
+      if (stageIndex == 0) {
+        chunk.position = sequence * kImageChunkSize;
+        chunk.length = std::min(kImageChunkSize, options.length - chunk.position);
+      }
+
+      lock.unlock();
+      int result = stage.run(chunk, workerIndex);
+      lock.lock();
+
+      if (result < 0) {
+        if (!failed)
+          error = std::string("failed to ") + stage.action + ": " + uv_strerror(result);
+        failed = true;
+      } else if (stageIndex + 1 == stages.size()) {
+        // done with this chunk, hand the buffer back to the reader
+        bytesDone += chunk.length;
+        chunk.sequence += numChunks;
+        chunk.stage = 0;
+        if (onProgress)
+          onProgress(bytesDone);
+      } else {
+        chunk.stage++;
+      }
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < stages.size(); i++) {
+    for (int j = 0; j < stages[i].threads; j++)
+      threads.emplace_back(worker, i, j);
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+
+  CloseFile();
+  if (failed) {
+    // don't leave a partial export around which looks like a valid image
+    if (options.mode == ImageMode::Export) {
+      uv_fs_t req;
+      uv_fs_unlink(nullptr, &req, options.path.c_str(), nullptr);
+      uv_fs_req_cleanup(&req);
+    }
+    return false;
+  }
+
+  FinishChecksum();
+  return true;
+}
+
+} // namespace xtsn
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "device.h"
+
+namespace xtsn {
+
+/**
+ * Size of each buffer in the image pipeline. A multiple of every sector size, so each buffer starts on a sector.
+ */
+constexpr uint64_t kImageChunkSize = 0x800000;
+
+/**
+ * Upper limit on cipher threads. Every thread adds another buffer to the pipeline, and past this the disk is the
+ * bottleneck anyway.
+ */
+constexpr int kMaxImageThreads = 8;
+
+enum class ImageMode {
+  // decrypt a range of the device into a plain image file
+  Export,
+  // encrypt a plain image file back into a range of the device
+  Import,
+  // decrypt a range of the device, only to checksum it
+  Verify,
+};
+
+enum class ImageChecksum {
+  None,
+  Sha256,
+  Crc32,
+};
+
+struct ImageOptions {
+  ImageMode mode;
+  // the plain image, unused when verifying
+  std::string path;
+  // where the partition starts in the device, the cipher sees offsets relative to this
+  uint64_t offset;
+  uint64_t length;
+  ImageChecksum checksum;
+  // number of threads running the cipher, clamped to `kMaxImageThreads`
+  int threads;
+};
+
+/**
+ * Copies a whole partition between a NandDevice and a plain image file, or just
+ * checksums it, as a pipeline of large aligned buffers: one thread reads, a pool
+ * of threads runs the cipher, and one thread each checksums and writes, so disk
+ * and crypto work overlap. The checksum is always of the plain data, so exports,
+ * imports and verifies of the same partition can be compared with each other.
+ *
+ * The device must not be used by anything else while the job runs.
+ */
+class ImageJob {
+public:
+  /**
+   * Cipher contexts are cloned here for each thread, so this must be called on the thread which owns `cipher`.
+   * @param cipher the partition's cipher, or null if it's stored in the clear
+   */
+  ImageJob(NandDevice &device, ImageOptions options, const DeviceCipher *cipher);
+  ~ImageJob();
+
+  /**
+   * Run the job to completion on the calling thread. `onProgress` is called from a pipeline thread with the
+   * number of bytes done after each buffer. Returns false on failure, see `Error`.
+   */
+  bool Run(std::function<void(uint64_t)> onProgress);
+
+  /**
+   * The lowercase hex checksum of the plain data, empty if no checksum was asked for.
+   */
+  const std::string &Checksum() const { return checksum; }
+  const std::string &Error() const { return error; }
+
+private:
+  struct Chunk {
+    unsigned char *data;
+    uint64_t sequence;
+    uint64_t position;
+    uint64_t length;
+    size_t stage;
+  };
+
+  struct Stage {
+    std::function<int(Chunk &, int)> run;
+    const char *action;
+    int threads;
+    uint64_t next;
+  };
+
+  NandDevice &device;
+  ImageOptions options;
+  bool encrypted;
+  uint64_t sectorSize;
+  std::vector<EVP_CIPHER_CTX *> tweakContexts;
+  std::vector<EVP_CIPHER_CTX *> cryptoContexts;
+
+  bool contextsCloned;
+  uv_file file;
+  EVP_MD_CTX *sha256;
+  uint32_t crc32;
+  std::string checksum;
+  std::string error;
+
+  int OpenFile();
+  void CloseFile();
+  int ReadFile(Chunk &chunk);
+  int WriteFile(Chunk &chunk);
+  int ReadDevice(Chunk &chunk);
+  int WriteDevice(Chunk &chunk);
+  int RunCipher(Chunk &chunk, int worker);
+  int UpdateChecksum(Chunk &chunk);
+  void FinishChecksum();
+};
+
+} // namespace xtsn
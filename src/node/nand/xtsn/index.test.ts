@@ -1,5 +1,9 @@
 import { describe, expect, test } from 'vitest';
-import { Xtsn } from './index';
+import crypto from 'node:crypto';
+import fs from 'node:fs';
+import os from 'node:os';
+import path from 'node:path';
+import { NandDevice, Xtsn } from './index';
 
 function isAllZeros(buf: Buffer): boolean {
   for (const byte of buf) {
@@ -154,5 +158,155 @@ describe(Xtsn.name, () => {
       const clear = xtsn.decrypt(crypt.subarray(0x4000, 0x4000 * 2), 0x4000);
       expect(isAllZeros(clear)).toBe(true);
     });
+
+    test('rejects offsets part way through a block', async () => {
+      const data = Buffer.alloc(0x4000);
+      expect(() => xtsn.encrypt(data, 0x4000 + 8)).toThrow('multiple of the block size');
+      expect(() => xtsn.decryptHC(data, 1, 0x4000, 8)).toThrow('multiple of the block size');
+      await expect(xtsn.encryptAsync(data, 0x4000 + 8)).rejects.toThrow('multiple of the block size');
+    });
+  });
+
+  describe('bulk', () => {
+    // these sizes cross both sector and internal batch boundaries
+    const cases: { sectorSize: number; byteOffset: number; length: number }[] = [
+      { sectorSize: 0x200, byteOffset: 0, length: 0x200 * 300 },
+      { sectorSize: 0x200, byteOffset: 0x1f0, length: 0x200 * 300 + 0x30 },
+      { sectorSize: 0x4000, byteOffset: 0x4000 * 7 + 0x40, length: 0x4000 * 9 },
+      { sectorSize: 0x20000, byteOffset: 0x1230, length: 0x20000 * 2 + 0x10 },
+    ];
+
+    for (const [i, { sectorSize, byteOffset, length }] of Object.entries(cases)) {
+      test(`matches block by block case[${i}]`, () => {
+        const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2), sectorSize);
+        const data = Buffer.alloc(length);
+        for (let j = 0; j < length; j++) data[j] = j % 251;
+
+        const bulk = xtsn.encrypt(Buffer.from(data), byteOffset);
+        const blocks = Buffer.from(data);
+        for (let j = 0; j < length; j += 16) {
+          xtsn.encrypt(blocks.subarray(j, j + 16), byteOffset + j);
+        }
+
+        expect(bulk.equals(blocks)).toBe(true);
+        expect(xtsn.decrypt(bulk, byteOffset).equals(data)).toBe(true);
+      });
+    }
+  });
+
+  describe('async', () => {
+    const cases: { sectorSize: number; byteOffset: number; length: number; threads?: number }[] = [
+      { sectorSize: 0x4000, byteOffset: 0, length: 0 },
+      { sectorSize: 0x4000, byteOffset: 0x40, length: 0x4000 * 3 },
+      { sectorSize: 0x4000, byteOffset: 0x4000 * 5 + 0x200, length: 0x4000 * 256 + 0x30, threads: 3 },
+      { sectorSize: 0x200, byteOffset: 0x1f0, length: 0x200 * 8192, threads: 8 },
+    ];
+
+    for (const [i, { sectorSize, byteOffset, length, threads }] of Object.entries(cases)) {
+      test(`matches sync case[${i}]`, async () => {
+        const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2), sectorSize);
+        const data = Buffer.alloc(length);
+        for (let j = 0; j < length; j++) data[j] = j % 251;
+
+        const sync = xtsn.encrypt(Buffer.from(data), byteOffset);
+        const crypt = await xtsn.encryptAsync(Buffer.from(data), byteOffset, threads);
+        expect(crypt.equals(sync)).toBe(true);
+
+        const clear = await xtsn.decryptAsync(crypt, byteOffset, threads);
+        expect(clear.equals(data)).toBe(true);
+      });
+    }
+
+    test('concurrent calls', async () => {
+      const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2), 0x4000);
+      const buffers = Array.from({ length: 8 }, (_, i) => Buffer.alloc(0x4000 * 128, i));
+      const expected = buffers.map((buf, i) => xtsn.encrypt(Buffer.from(buf), i * 0x4000));
+
+      const results = await Promise.all(buffers.map((buf, i) => xtsn.encryptAsync(buf, i * 0x4000)));
+      results.forEach((result, i) => expect(result.equals(expected[i])).toBe(true));
+    });
+  });
+});
+
+describe(NandDevice.name, () => {
+  describe('images', () => {
+    // a partition which doesn't start or end on a split file boundary, and isn't a whole number of buffers
+    const partitionOffset = 0x4400;
+    const partitionLength = 0x800000 * 2 + 0x4000 * 3 + 0x230;
+    const splitSize = 0x700013;
+
+    function createDump(xtsn: Xtsn, plain: Buffer) {
+      const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'xtsn-'));
+      const crypt = xtsn.encrypt(Buffer.from(plain));
+      const whole = Buffer.concat([Buffer.alloc(partitionOffset, 1), crypt, Buffer.alloc(0x1234, 2)]);
+
+      const paths: string[] = [];
+      for (let offset = 0; offset < whole.byteLength; offset += splitSize) {
+        const partPath = path.join(dir, `rawnand.bin.${String(paths.length).padStart(2, '0')}`);
+        fs.writeFileSync(partPath, whole.subarray(offset, offset + splitSize));
+        paths.push(partPath);
+      }
+
+      const readAll = () => Buffer.concat(paths.map((partPath) => fs.readFileSync(partPath)));
+      return { dir, device: new NandDevice(paths), whole, readAll };
+    }
+
+    const sha256 = (data: Buffer) => crypto.createHash('sha256').update(data).digest('hex');
+
+    test('export, verify and import round trip', async () => {
+      const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2));
+      const plain = crypto.randomBytes(partitionLength);
+      const { dir, device, whole, readAll } = createDump(xtsn, plain);
+      try {
+        const progress: number[] = [];
+        const imagePath = path.join(dir, 'partition.img');
+        const exported = await device.exportImage(imagePath, partitionOffset, partitionLength, {
+          xtsn,
+          checksum: 'sha256',
+          threads: 3,
+          onProgress: (bytesDone) => progress.push(bytesDone),
+        });
+        expect(exported).toBe(sha256(plain));
+        expect(fs.readFileSync(imagePath).equals(plain)).toBe(true);
+        expect(progress.at(-1)).toBe(partitionLength);
+
+        const crc = await device.verify(partitionOffset, partitionLength, { xtsn, checksum: 'crc32' });
+        expect(crc).toMatch(/^[0-9a-f]{8}$/);
+
+        const replacement = crypto.randomBytes(partitionLength);
+        fs.writeFileSync(imagePath, replacement);
+        const imported = await device.importImage(imagePath, partitionOffset, partitionLength, {
+          xtsn,
+          checksum: 'sha256',
+        });
+        expect(imported).toBe(sha256(replacement));
+        expect(await device.verify(partitionOffset, partitionLength, { xtsn, checksum: 'sha256' })).toBe(imported);
+
+        // nothing outside the partition is touched
+        const after = readAll();
+        const partitionEnd = partitionOffset + partitionLength;
+        expect(after.subarray(0, partitionOffset).equals(whole.subarray(0, partitionOffset))).toBe(true);
+        expect(after.subarray(partitionEnd).equals(whole.subarray(partitionEnd))).toBe(true);
+      } finally {
+        device.close();
+        fs.rmSync(dir, { recursive: true });
+      }
+    });
+
+    test('rejects bad images', async () => {
+      const xtsn = new Xtsn(Buffer.alloc(16, 1), Buffer.alloc(16, 2));
+      const { dir, device } = createDump(xtsn, Buffer.alloc(partitionLength));
+      try {
+        const imagePath = path.join(dir, 'short.img');
+        fs.writeFileSync(imagePath, Buffer.alloc(16));
+        await expect(device.importImage(imagePath, partitionOffset, partitionLength, { xtsn })).rejects.toThrow(
+          'not the same size',
+        );
+        await expect(device.verify(0, device.size() + 16)).rejects.toThrow('past the end');
+      } finally {
+        device.close();
+        fs.rmSync(dir, { recursive: true });
+      }
+    });
   });
 });
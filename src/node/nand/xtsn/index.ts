@@ -16,6 +16,8 @@ const require = globalThis.require ?? createRequire(import.meta.url);
 const XtsnCipher: NativeCipherConstructor = require('./build/Release/xtsn.node');
 
 interface NativeCipherConstructor {
+  NandDevice: NativeNandDeviceConstructor;
+
   /**
    * Create a new instance of the cipher class.
    * @param cryptoKey the 16 byte Crypto Bis Key
@@ -31,11 +33,116 @@ interface NativeCipher {
    * The operation runs in-place; that is, it mutates the input buffer.
    * @param input data to run the cipher on
    * @param sectorOffset starting sector offset
-   * @param skippedBytes number of bytes skipped in the current sector offset
+   * @param skippedBytes number of bytes skipped in the current sector offset, a multiple of 16
    * @param encrypt whether to encrypt or decrypt
    * @returns the input buffer
    */
   run(input: Buffer, sectorOffset: number, skippedBytes: number, encrypt: boolean): void;
+
+  /**
+   * Same as `run`, but the work is done on the libuv threadpool. Large inputs
+   * are split on sector boundaries and processed by multiple threads at once.
+   * The input buffer must not be touched until the returned promise resolves.
+   * @param input data to run the cipher on
+   * @param sectorOffset starting sector offset
+   * @param skippedBytes number of bytes skipped in the current sector offset, a multiple of 16
+   * @param encrypt whether to encrypt or decrypt
+   * @param threads maximum number of threads to use, defaults to the threadpool size
+   */
+  runAsync(
+    input: Buffer,
+    sectorOffset: number,
+    skippedBytes: number,
+    encrypt: boolean,
+    threads?: number,
+  ): Promise<void>;
+}
+
+interface NativeNandDeviceConstructor {
+  /**
+   * Open a NAND dump.
+   * @param paths the dump file, or all the parts of a split dump in order
+   */
+  new (paths: string[]): NativeNandDevice;
+}
+
+interface NativeNandDevice {
+  /**
+   * Read `target.byteLength` bytes from `offset` directly into `target`.
+   * @param target where to read the data into
+   * @param offset offset in the dump to read from
+   * @param cipher if provided, the data is decrypted with this cipher
+   * @param cryptoOffset the byte offset used for the cipher, i.e. the offset within the partition
+   * @returns the number of bytes read
+   */
+  read(target: Uint8Array, offset: number, cipher?: NativeCipher, cryptoOffset?: number): number;
+
+  /**
+   * Write all of `source` to `offset`. When a cipher is provided the data is encrypted
+   * before it's written, but `source` itself is left untouched.
+   * @param source the data to write
+   * @param offset offset in the dump to write to
+   * @param cipher if provided, the data is encrypted with this cipher
+   * @param cryptoOffset the byte offset used for the cipher, i.e. the offset within the partition
+   * @returns the number of bytes written
+   */
+  write(source: Uint8Array, offset: number, cipher?: NativeCipher, cryptoOffset?: number): number;
+
+  /**
+   * Copy `length` bytes at `offset` out into a new plain image at `path`, decrypting them if a cipher is provided.
+   * Resolves to the checksum of the plain data, or an empty string if no checksum was asked for.
+   */
+  exportImage(
+    path: string,
+    offset: number,
+    length: number,
+    cipher?: NativeCipher,
+    checksum?: ImageChecksum,
+    threads?: number,
+    onProgress?: (bytesDone: number) => void,
+  ): Promise<string>;
+
+  /**
+   * Copy the plain image at `path` into `length` bytes at `offset`, encrypting it if a cipher is provided.
+   * The image must be exactly `length` bytes. Resolves to the checksum of the plain data.
+   */
+  importImage(
+    path: string,
+    offset: number,
+    length: number,
+    cipher?: NativeCipher,
+    checksum?: ImageChecksum,
+    threads?: number,
+    onProgress?: (bytesDone: number) => void,
+  ): Promise<string>;
+
+  /**
+   * Read `length` bytes at `offset`, decrypting them if a cipher is provided, and resolve to their checksum.
+   */
+  verify(
+    offset: number,
+    length: number,
+    cipher?: NativeCipher,
+    checksum?: ImageChecksum,
+    threads?: number,
+    onProgress?: (bytesDone: number) => void,
+  ): Promise<string>;
+
+  size(): number;
+  close(): void;
+}
+
+export type ImageChecksum = 'sha256' | 'crc32';
+
+export interface ImageOptions {
+  /** the partition's cipher, leave this out if the partition isn't encrypted */
+  xtsn?: Xtsn;
+  /** checksum of the plain data to take on the way through */
+  checksum?: ImageChecksum;
+  /** number of threads running the cipher (at most 8), defaults to the threadpool size */
+  threads?: number;
+  /** called with the number of bytes done so far, at most once per buffer */
+  onProgress?: (bytesDone: number) => void;
 }
 
 /**
@@ -48,7 +155,8 @@ interface NativeCipher {
  * See https://switchbrew.org/wiki/Flash_Filesystem for more information.
  */
 export class Xtsn {
-  private readonly cipher: NativeCipher;
+  /** @internal */
+  public readonly cipher: NativeCipher;
 
   constructor(
     private readonly cryptoKey: Buffer,
@@ -70,6 +178,18 @@ export class Xtsn {
     return input;
   }
 
+  public async encryptAsync(input: Buffer, byteOffset = 0, threads?: number): Promise<Buffer> {
+    const sectorOffset = Math.floor(byteOffset / this.sectorSize);
+    await this.cipher.runAsync(input, sectorOffset, byteOffset % this.sectorSize, true, threads);
+    return input;
+  }
+
+  public async decryptAsync(input: Buffer, byteOffset = 0, threads?: number): Promise<Buffer> {
+    const sectorOffset = Math.floor(byteOffset / this.sectorSize);
+    await this.cipher.runAsync(input, sectorOffset, byteOffset % this.sectorSize, false, threads);
+    return input;
+  }
+
   // Expose APIs that are compatible with the python haccrypto lib
 
   public encryptHC(input: Buffer, sectorOffset: number, sectorSize = 0x200, skippedBytes = 0): Buffer {
@@ -84,3 +204,59 @@ export class Xtsn {
     return input;
   }
 }
+
+/**
+ * A NAND dump on disk (either combined or split) which reads and writes
+ * directly from/into the provided buffers, and runs the cipher natively while
+ * doing so. Reads and writes don't need to be aligned to the cipher's blocks.
+ */
+export class NandDevice {
+  private readonly device: NativeNandDevice;
+
+  constructor(paths: string[]) {
+    this.device = new XtsnCipher.NandDevice(paths);
+  }
+
+  /** whether the loaded addon was built with the native device, older builds only have the cipher */
+  public static isSupported(): boolean {
+    return typeof XtsnCipher.NandDevice === 'function';
+  }
+
+  public size(): number {
+    return this.device.size();
+  }
+
+  public close() {
+    this.device.close();
+  }
+
+  public read(offset: number, target: Uint8Array, xtsn?: Xtsn, cryptoOffset = 0): number {
+    return xtsn ? this.device.read(target, offset, xtsn.cipher, cryptoOffset) : this.device.read(target, offset);
+  }
+
+  public write(offset: number, source: Uint8Array, xtsn?: Xtsn, cryptoOffset = 0): number {
+    return xtsn ? this.device.write(source, offset, xtsn.cipher, cryptoOffset) : this.device.write(source, offset);
+  }
+
+  /*
+   * These copy a whole partition between the device and a plain image file on native threads, with reads, the
+   * cipher, the checksum and writes all overlapping. The device can't be used for anything else until the returned
+   * promise settles. Each resolves to the checksum of the plain data (empty if none was asked for), which is the
+   * same for an export, an import or a verify of the same data, so they can be checked against each other.
+   */
+
+  public exportImage(path: string, offset: number, length: number, options: ImageOptions = {}): Promise<string> {
+    const { xtsn, checksum, threads, onProgress } = options;
+    return this.device.exportImage(path, offset, length, xtsn?.cipher, checksum, threads, onProgress);
+  }
+
+  public importImage(path: string, offset: number, length: number, options: ImageOptions = {}): Promise<string> {
+    const { xtsn, checksum, threads, onProgress } = options;
+    return this.device.importImage(path, offset, length, xtsn?.cipher, checksum, threads, onProgress);
+  }
+
+  public verify(offset: number, length: number, options: ImageOptions = {}): Promise<string> {
+    const { xtsn, checksum, threads, onProgress } = options;
+    return this.device.verify(offset, length, xtsn?.cipher, checksum, threads, onProgress);
+  }
+}
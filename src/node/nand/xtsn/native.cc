@@ -1,26 +1,50 @@
-#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <node.h>
 #include <node_buffer.h>
 #include <openssl/evp.h>
+#include <stdlib.h>
+#include <thread>
+#include <uv.h>
+#include <vector>
+
+#include "device.h"
+#include "image.h"
+#include "xts.h"
 
 namespace xtsn {
 
+using v8::Array;
 using v8::Context;
 using v8::External;
 using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
+using v8::Global;
+using v8::HandleScope;
 using v8::Isolate;
 using v8::Local;
 using v8::NewStringType;
 using v8::Number;
 using v8::Object;
 using v8::Persistent;
+using v8::Promise;
 using v8::String;
+using v8::Undefined;
 using v8::Value;
 using v8::WeakCallbackInfo;
 using v8::WeakCallbackType;
 
+/**
+ * A tweak and crypto context pair which is owned by a single thread while in use.
+ */
+struct CipherContexts {
+  EVP_CIPHER_CTX *tweak;
+  EVP_CIPHER_CTX *crypto;
+  bool encrypt;
+};
+
 class Ciphers {
 public:
   /**
@@ -35,6 +59,15 @@ public:
    */
   Persistent<Object> persistent;
 
+  /**
+   * Clones of the above contexts for use off the JS thread. OpenSSL contexts
+   * can't be shared between threads, so the contexts in `ctx_list` are only
+   * ever used on the JS thread, and each async work item checks out its own
+   * clones from this pool and returns them when it's done.
+   */
+  std::mutex poolMutex;
+  std::vector<CipherContexts> pool;
+
   Ciphers(Isolate *isolate, Local<Object> jsObj, unsigned char *tweakKeyData, unsigned char *cryptoKeyData)
       : persistent(isolate, jsObj) {
     ctx_list[0] = EVP_CIPHER_CTX_new();
@@ -57,6 +90,36 @@ public:
     EVP_CIPHER_CTX_free(ctx_list[0]);
     EVP_CIPHER_CTX_free(ctx_list[1]);
     EVP_CIPHER_CTX_free(ctx_list[2]);
+
+    for (CipherContexts &contexts : pool) {
+      EVP_CIPHER_CTX_free(contexts.tweak);
+      EVP_CIPHER_CTX_free(contexts.crypto);
+    }
+  }
+
+  CipherContexts Acquire(bool encrypt) {
+    {
+      std::lock_guard<std::mutex> lock(poolMutex);
+      for (auto it = pool.begin(); it != pool.end(); it++) {
+        if (it->encrypt == encrypt) {
+          CipherContexts contexts = *it;
+          pool.erase(it);
+          return contexts;
+        }
+      }
+    }
+
+    CipherContexts contexts = {EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_new(), encrypt};
+    int ok = EVP_CIPHER_CTX_copy(contexts.tweak, ctx_list[0]) &&
+             EVP_CIPHER_CTX_copy(contexts.crypto, ctx_list[encrypt ? 1 : 2]);
+    assert(ok);
+    (void)ok;
+    return contexts;
+  }
+
+  void Release(CipherContexts contexts) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    pool.push_back(contexts);
   }
 
   static void FreeXtsnCipherInstance(const WeakCallbackInfo<Ciphers> &info) {
@@ -107,58 +170,110 @@ void CreateXtsnCipherInstance(const FunctionCallbackInfo<Value> &args) {
   args.GetReturnValue().Set(jsObject);
 }
 
-void InitTweak(EVP_CIPHER_CTX *ctx_tweak, unsigned char *tweak, uint64_t sectorOffset) {
-#if defined(__GNUC__) || defined(__clang__)
-  uint64_t sectorOffsetBigEndian = __builtin_bswap64(sectorOffset);
-  memcpy(tweak + 8, &sectorOffsetBigEndian, sizeof(uint64_t));
-#elif defined(_MSC_VER)
-  uint64_t sectorOffsetBigEndian = _byteswap_uint64(sectorOffset);
-  memcpy(tweak + 8, &sectorOffsetBigEndian, sizeof(uint64_t));
-#else
-  for (int i = 0; i < sizeof(uint64_t); i++)
-    tweak[15 - i] = ((unsigned char *)&sectorOffset)[i];
-#endif
+void RunCipherMethod(const FunctionCallbackInfo<Value> &args) {
+  Isolate *isolate = args.GetIsolate();
 
-  int outputLen = 0;
-  assert(EVP_CipherUpdate(ctx_tweak, tweak, &outputLen, tweak, 16));
-}
+  // validate arguments from js
+  if (args.Length() < 4 || !node::Buffer::HasInstance(args[0]) || !args[1]->IsNumber() || !args[2]->IsNumber()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "invalid arguments").ToLocalChecked());
+    return;
+  }
 
-inline void UpdateTweak(unsigned char *tweak) {
-  bool last_high = (bool)(tweak[15] & 0x80);
+  // extract arguments from js
+  unsigned char *input = reinterpret_cast<unsigned char *>(node::Buffer::Data(args[0]));
+  uint64_t inputLen = node::Buffer::Length(args[0]);
+  uint64_t sectorOffset = args[1]->NumberValue(isolate->GetCurrentContext()).FromJust();
+  uint64_t skippedBytes = args[2]->NumberValue(isolate->GetCurrentContext()).FromJust();
+  if (skippedBytes % kBlockSize != 0) {
+    isolate->ThrowException(
+        String::NewFromUtf8(isolate, "skippedBytes must be a multiple of the block size").ToLocalChecked());
+    return;
+  }
+  bool encrypt = args[3]->BooleanValue(isolate);
 
-  uint64_t *tweak64bit = reinterpret_cast<uint64_t *>(tweak);
-  tweak64bit[1] = tweak64bit[1] << 1 | (tweak64bit[0] >> 63);
-  tweak64bit[0] = tweak64bit[0] << 1 ^ (last_high * 0x87);
+  // extract saved fields
+  int sectorSize = args.This()->GetInternalField(1).As<Number>()->NumberValue(isolate->GetCurrentContext()).FromJust();
+
+  Ciphers *ciphers = reinterpret_cast<Ciphers *>(args.Holder()->GetAlignedPointerFromInternalField(0));
+  EVP_CIPHER_CTX *ctx_tweak = ciphers->ctx_list[0];
+  EVP_CIPHER_CTX *ctx_crypto = ciphers->ctx_list[encrypt ? 1 : 2];
+
+  RunXts(ctx_tweak, ctx_crypto, input, inputLen, sectorOffset, skippedBytes, sectorSize);
 }
 
-inline void ProcessChunks(EVP_CIPHER_CTX *ctx_crypto, unsigned char *input, unsigned char *tweak, uint64_t *chunkOffset,
-                          uint64_t totalChunks, int runs) {
-  uint64_t *tweak64bit = reinterpret_cast<uint64_t *>(tweak);
-  uint64_t *input64bit = reinterpret_cast<uint64_t *>(input);
+/**
+ * Don't bother splitting work into slices smaller than this
+ */
+constexpr uint64_t kMinAsyncSliceSize = 0x100000;
+
+/**
+ * Shared state for a single `runAsync` call, which may be split over many work items
+ */
+struct AsyncCipherJob {
+  Isolate *isolate;
+  Global<Context> context;
+  Global<Promise::Resolver> resolver;
+  // keep the cipher instance and input buffer alive while the threadpool is using them
+  Global<Object> holder;
+  Global<Value> input;
+  Ciphers *ciphers;
+  int pending;
+};
 
-  int unusedOutputLen = 0;
-  for (int i = 0; i < runs; i++) {
-    if (*chunkOffset >= totalChunks)
-      return;
+struct AsyncCipherWork {
+  uv_work_t request;
+  AsyncCipherJob *job;
+  CipherContexts contexts;
+  unsigned char *data;
+  uint64_t length;
+  uint64_t sectorOffset;
+  uint64_t skippedBytes;
+  uint64_t sectorSize;
+};
 
-    input64bit[*chunkOffset + 0] ^= tweak64bit[0];
-    input64bit[*chunkOffset + 1] ^= tweak64bit[1];
+int DefaultThreadCount() {
+  // libuv will never run more than this many work items at once
+  const char *value = getenv("UV_THREADPOOL_SIZE");
+  int threads = value ? atoi(value) : 0;
+  return threads > 0 ? threads : 4;
+}
 
-    unsigned char *block = input + (*chunkOffset * 8);
-    assert(EVP_CipherUpdate(ctx_crypto, block, &unusedOutputLen, block, 16));
+void ExecuteAsyncCipherWork(uv_work_t *request) {
+  AsyncCipherWork *work = reinterpret_cast<AsyncCipherWork *>(request->data);
+  RunXts(work->contexts.tweak, work->contexts.crypto, work->data, work->length, work->sectorOffset,
+         work->skippedBytes, work->sectorSize);
+}
 
-    input64bit[*chunkOffset + 0] ^= tweak64bit[0];
-    input64bit[*chunkOffset + 1] ^= tweak64bit[1];
+void CompleteAsyncCipherWork(uv_work_t *request, int status) {
+  AsyncCipherWork *work = reinterpret_cast<AsyncCipherWork *>(request->data);
+  AsyncCipherJob *job = work->job;
+  job->ciphers->Release(work->contexts);
+  delete work;
 
-    UpdateTweak(tweak);
+  if (--job->pending > 0)
+    return;
 
-    // we're processing two 64bit chunks at a time (the cipher is a 128bit cipher)
-    *chunkOffset += 2;
+  Isolate *isolate = job->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = job->context.Get(isolate);
+  Context::Scope contextScope(context);
+  // this drains the microtask queue when it goes out of scope, so the promise's handlers run
+  node::CallbackScope callbackScope(isolate, job->holder.Get(isolate), {0, 0});
+
+  Local<Promise::Resolver> resolver = job->resolver.Get(isolate);
+  if (status == UV_ECANCELED) {
+    resolver->Reject(context, String::NewFromUtf8(isolate, "cipher operation was cancelled").ToLocalChecked())
+        .FromJust();
+  } else {
+    resolver->Resolve(context, Undefined(isolate)).FromJust();
   }
+
+  delete job;
 }
 
-void RunCipherMethod(const FunctionCallbackInfo<Value> &args) {
+void RunAsyncCipherMethod(const FunctionCallbackInfo<Value> &args) {
   Isolate *isolate = args.GetIsolate();
+  Local<Context> context = isolate->GetCurrentContext();
 
   // validate arguments from js
   if (args.Length() < 4 || !node::Buffer::HasInstance(args[0]) || !args[1]->IsNumber() || !args[2]->IsNumber()) {
@@ -169,53 +284,384 @@ void RunCipherMethod(const FunctionCallbackInfo<Value> &args) {
   // extract arguments from js
   unsigned char *input = reinterpret_cast<unsigned char *>(node::Buffer::Data(args[0]));
   uint64_t inputLen = node::Buffer::Length(args[0]);
-  uint64_t sectorOffset = args[1]->NumberValue(isolate->GetCurrentContext()).FromJust();
-  uint64_t skippedBytes = args[2]->NumberValue(isolate->GetCurrentContext()).FromJust();
+  uint64_t sectorOffset = args[1]->NumberValue(context).FromJust();
+  uint64_t skippedBytes = args[2]->NumberValue(context).FromJust();
+  if (skippedBytes % kBlockSize != 0) {
+    isolate->ThrowException(
+        String::NewFromUtf8(isolate, "skippedBytes must be a multiple of the block size").ToLocalChecked());
+    return;
+  }
   bool encrypt = args[3]->BooleanValue(isolate);
+  int threads = args.Length() > 4 && args[4]->IsNumber() ? args[4]->Int32Value(context).FromJust() : 0;
+  if (threads <= 0)
+    threads = DefaultThreadCount();
 
   // extract saved fields
-  int sectorSize = args.This()->GetInternalField(1).As<Number>()->NumberValue(isolate->GetCurrentContext()).FromJust();
-
+  uint64_t sectorSize = args.This()->GetInternalField(1).As<Number>()->NumberValue(context).FromJust();
   Ciphers *ciphers = reinterpret_cast<Ciphers *>(args.Holder()->GetAlignedPointerFromInternalField(0));
-  EVP_CIPHER_CTX *ctx_tweak = ciphers->ctx_list[0];
-  EVP_CIPHER_CTX *ctx_crypto = ciphers->ctx_list[encrypt ? 1 : 2];
 
-  // we measure our current offset through the input in 64bit chunks
-  uint64_t chunkOffset = 0;
-  uint64_t totalChunks = inputLen / 8;
+  Local<Promise::Resolver> resolver = Promise::Resolver::New(context).ToLocalChecked();
+  args.GetReturnValue().Set(resolver->GetPromise());
+
+  // work in blocks relative to the start of the first sector, so slices can be split on sector boundaries
+  uint64_t blocksPerSector = sectorSize / kBlockSize;
+  sectorOffset += skippedBytes / sectorSize;
+  uint64_t firstBlock = (skippedBytes % sectorSize) / kBlockSize;
+  uint64_t endBlock = firstBlock + inputLen / kBlockSize;
+
+  // each slice is a whole number of sectors, and isn't smaller than the minimum slice size
+  uint64_t sectors = (endBlock + blocksPerSector - 1) / blocksPerSector;
+  uint64_t sectorsPerSlice = (sectors + threads - 1) / threads;
+  uint64_t minSectorsPerSlice = (kMinAsyncSliceSize + sectorSize - 1) / sectorSize;
+  if (sectorsPerSlice < minSectorsPerSlice)
+    sectorsPerSlice = minSectorsPerSlice;
+  uint64_t blocksPerSlice = sectorsPerSlice * blocksPerSector;
+
+  AsyncCipherJob *job = new AsyncCipherJob();
+  job->isolate = isolate;
+  job->context.Reset(isolate, context);
+  job->resolver.Reset(isolate, resolver);
+  job->holder.Reset(isolate, args.Holder());
+  job->input.Reset(isolate, args[0]);
+  job->ciphers = ciphers;
+  job->pending = 0;
+
+  std::vector<AsyncCipherWork *> items;
+  for (uint64_t start = firstBlock; start < endBlock || items.empty();) {
+    uint64_t end = std::min(endBlock, (start / blocksPerSlice + 1) * blocksPerSlice);
+
+    AsyncCipherWork *work = new AsyncCipherWork();
+    work->request.data = work;
+    work->job = job;
+    work->contexts = ciphers->Acquire(encrypt);
+    work->data = input + (start - firstBlock) * kBlockSize;
+    work->length = (end - start) * kBlockSize;
+    work->sectorOffset = sectorOffset + start / blocksPerSector;
+    work->skippedBytes = (start % blocksPerSector) * kBlockSize;
+    work->sectorSize = sectorSize;
+    items.push_back(work);
+
+    start = end;
+  }
 
-  // see if we can completely skip any sectors
-  if (skippedBytes > 0) {
-    int fullSectorsToSkip = std::floor(skippedBytes / sectorSize);
-    sectorOffset += fullSectorsToSkip;
-    skippedBytes %= sectorSize;
+  // all items need to be counted before any of them are able to complete
+  job->pending = items.size();
+  uv_loop_t *loop = node::GetCurrentEventLoop(isolate);
+  for (AsyncCipherWork *work : items) {
+    uv_queue_work(loop, &work->request, ExecuteAsyncCipherWork, CompleteAsyncCipherWork);
   }
+}
 
-  // if we have remaining skipped bytes, that means we're up to the first sector
-  // we need to run the cipher on
-  if (skippedBytes > 0) {
-    unsigned char tweak[16] = {0};
-    InitTweak(ctx_tweak, tweak, sectorOffset);
+/**
+ * Used to check that objects passed to NandDevice methods really are XtsnCipher instances
+ */
+Persistent<FunctionTemplate> cipherTemplate;
 
-    // update the tweak for all chunks before the first chunk we need to process
-    for (int i = 0; i < std::floor(skippedBytes / 16); i++) {
-      UpdateTweak(tweak);
-    }
+class NandDeviceInstance {
+public:
+  NandDevice device;
+
+  /**
+   * Set while an image job owns the device, no other methods can use it until the job is done
+   */
+  bool busy = false;
+
+  /**
+   * Required to be able to run code after the JS object is GC'd
+   */
+  Persistent<Object> persistent;
 
-    // finally, process the rest of the chunks in this sector
-    ProcessChunks(ctx_crypto, input, tweak, &chunkOffset, totalChunks, std::floor((sectorSize - skippedBytes) / 16));
-    sectorOffset++;
+  NandDeviceInstance(Isolate *isolate, Local<Object> jsObj, std::vector<std::string> paths)
+      : device(paths), persistent(isolate, jsObj) {
+    // setup callback to run after the js object is GC'd
+    this->persistent.SetWeak(this, NandDeviceInstance::FreeNandDeviceInstance, WeakCallbackType::kParameter);
   }
 
-  // now we're sector-aligned and can proceed to process each remaining sector
-  while (chunkOffset < totalChunks) {
-    unsigned char tweak[16] = {0};
-    InitTweak(ctx_tweak, tweak, sectorOffset);
-    ProcessChunks(ctx_crypto, input, tweak, &chunkOffset, totalChunks, std::floor(sectorSize / 16));
-    sectorOffset++;
+  static void FreeNandDeviceInstance(const WeakCallbackInfo<NandDeviceInstance> &info) {
+    NandDeviceInstance *instance = reinterpret_cast<NandDeviceInstance *>(info.GetParameter());
+
+    // V8 requires that we reset this when the weak callback is run
+    instance->persistent.Reset();
+
+    // this calls the destructor, which closes any open files
+    delete instance;
   }
+};
+
+void ThrowUvError(Isolate *isolate, int64_t code) {
+  isolate->ThrowException(v8::Exception::Error(String::NewFromUtf8(isolate, uv_strerror(code)).ToLocalChecked()));
 }
 
+void CreateNandDeviceInstance(const FunctionCallbackInfo<Value> &args) {
+  Isolate *isolate = args.GetIsolate();
+  Local<Context> context = isolate->GetCurrentContext();
+
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "Constructor NandDevice requires 'new'").ToLocalChecked());
+    return;
+  }
+
+  if (args.Length() < 1 || !args[0]->IsArray() || args[0].As<Array>()->Length() == 0) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "invalid arguments").ToLocalChecked());
+    return;
+  }
+
+  std::vector<std::string> paths;
+  Local<Array> pathArray = args[0].As<Array>();
+  for (uint32_t i = 0; i < pathArray->Length(); i++) {
+    String::Utf8Value path(isolate, pathArray->Get(context, i).ToLocalChecked());
+    paths.push_back(*path);
+  }
+
+  Local<Object> jsObject = args.This();
+  NandDeviceInstance *instance = new NandDeviceInstance(isolate, jsObject, paths);
+  jsObject->SetAlignedPointerInInternalField(0, instance);
+
+  int result = instance->device.Open();
+  if (result < 0) {
+    ThrowUvError(isolate, result);
+    return;
+  }
+
+  args.GetReturnValue().Set(jsObject);
+}
+
+/**
+ * Extract the cipher contexts from an optional XtsnCipher argument, returns false if the argument is invalid
+ */
+bool GetDeviceCipher(Isolate *isolate, Local<Value> value, DeviceCipher *cipher, bool *hasCipher) {
+  *hasCipher = false;
+  if (value->IsUndefined() || value->IsNull())
+    return true;
+
+  if (!value->IsObject() || !cipherTemplate.Get(isolate)->HasInstance(value))
+    return false;
+
+  Local<Object> cipherObject = value.As<Object>();
+  Ciphers *ciphers = reinterpret_cast<Ciphers *>(cipherObject->GetAlignedPointerFromInternalField(0));
+  cipher->tweak = ciphers->ctx_list[0];
+  cipher->encrypt = ciphers->ctx_list[1];
+  cipher->decrypt = ciphers->ctx_list[2];
+  cipher->sectorSize =
+      cipherObject->GetInternalField(1).As<Number>()->NumberValue(isolate->GetCurrentContext()).FromJust();
+  *hasCipher = true;
+  return true;
+}
+
+void RunDeviceIoMethod(const FunctionCallbackInfo<Value> &args, bool write) {
+  Isolate *isolate = args.GetIsolate();
+  Local<Context> context = isolate->GetCurrentContext();
+
+  // validate arguments from js
+  DeviceCipher cipher;
+  bool hasCipher = false;
+  if (args.Length() < 2 || !node::Buffer::HasInstance(args[0]) || !args[1]->IsNumber() ||
+      !GetDeviceCipher(isolate, args[2], &cipher, &hasCipher) || (hasCipher && !args[3]->IsNumber())) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "invalid arguments").ToLocalChecked());
+    return;
+  }
+
+  // extract arguments from js
+  unsigned char *data = reinterpret_cast<unsigned char *>(node::Buffer::Data(args[0]));
+  uint64_t dataLen = node::Buffer::Length(args[0]);
+  uint64_t offset = args[1]->NumberValue(context).FromJust();
+  uint64_t cryptoOffset = hasCipher ? args[3]->NumberValue(context).FromJust() : 0;
+
+  NandDeviceInstance *instance =
+      reinterpret_cast<NandDeviceInstance *>(args.Holder()->GetAlignedPointerFromInternalField(0));
+  if (instance->busy) {
+    ThrowUvError(isolate, UV_EBUSY);
+    return;
+  }
+
+  int64_t result = write ? instance->device.Write(offset, data, dataLen, hasCipher ? &cipher : nullptr, cryptoOffset)
+                         : instance->device.Read(offset, data, dataLen, hasCipher ? &cipher : nullptr, cryptoOffset);
+  if (result < 0) {
+    ThrowUvError(isolate, result);
+    return;
+  }
+
+  args.GetReturnValue().Set(Number::New(isolate, result));
+}
+
+void ReadDeviceMethod(const FunctionCallbackInfo<Value> &args) { RunDeviceIoMethod(args, false); }
+
+void WriteDeviceMethod(const FunctionCallbackInfo<Value> &args) { RunDeviceIoMethod(args, true); }
+
+void SizeDeviceMethod(const FunctionCallbackInfo<Value> &args) {
+  NandDeviceInstance *instance =
+      reinterpret_cast<NandDeviceInstance *>(args.Holder()->GetAlignedPointerFromInternalField(0));
+  args.GetReturnValue().Set(Number::New(args.GetIsolate(), instance->device.Size()));
+}
+
+void CloseDeviceMethod(const FunctionCallbackInfo<Value> &args) {
+  NandDeviceInstance *instance =
+      reinterpret_cast<NandDeviceInstance *>(args.Holder()->GetAlignedPointerFromInternalField(0));
+  if (instance->busy) {
+    ThrowUvError(args.GetIsolate(), UV_EBUSY);
+    return;
+  }
+
+  instance->device.Close();
+}
+
+/**
+ * State for a single image job, which runs on its own thread and reports back to the JS thread through `async`
+ */
+struct AsyncImageJob {
+  Isolate *isolate;
+  Global<Context> context;
+  Global<Promise::Resolver> resolver;
+  // keep the device and cipher instances alive while the job is using them
+  Global<Object> holder;
+  Global<Value> cipher;
+  Global<Function> onProgress;
+  NandDeviceInstance *instance;
+  ImageJob *job;
+  std::thread thread;
+  uv_async_t async;
+  std::atomic<uint64_t> bytesDone;
+  std::atomic<bool> done;
+  bool success;
+  uint64_t reportedBytes;
+};
+
+void ReportImageProgress(AsyncImageJob *imageJob, Local<Context> context) {
+  uint64_t bytesDone = imageJob->bytesDone.load();
+  if (imageJob->onProgress.IsEmpty() || bytesDone == imageJob->reportedBytes)
+    return;
+
+  Isolate *isolate = imageJob->isolate;
+  imageJob->reportedBytes = bytesDone;
+  Local<Value> argv[] = {Number::New(isolate, bytesDone)};
+  // an exception from the callback is reported like any other uncaught exception, it doesn't stop the job
+  imageJob->onProgress.Get(isolate)->Call(context, Undefined(isolate), 1, argv).IsEmpty();
+}
+
+void CompleteImageJob(uv_async_t *async) {
+  AsyncImageJob *imageJob = reinterpret_cast<AsyncImageJob *>(async->data);
+  Isolate *isolate = imageJob->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = imageJob->context.Get(isolate);
+  Context::Scope contextScope(context);
+  // this drains the microtask queue when it goes out of scope, so the promise's handlers run
+  node::CallbackScope callbackScope(isolate, imageJob->holder.Get(isolate), {0, 0});
+
+  // sends are coalesced, so this may be any number of buffers after the last call
+  bool done = imageJob->done.load();
+  ReportImageProgress(imageJob, context);
+  if (!done)
+    return;
+
+  imageJob->thread.join();
+  imageJob->instance->busy = false;
+
+  Local<Promise::Resolver> resolver = imageJob->resolver.Get(isolate);
+  ImageJob *job = imageJob->job;
+  if (imageJob->success) {
+    resolver->Resolve(context, String::NewFromUtf8(isolate, job->Checksum().c_str()).ToLocalChecked()).FromJust();
+  } else {
+    Local<Value> error = v8::Exception::Error(String::NewFromUtf8(isolate, job->Error().c_str()).ToLocalChecked());
+    resolver->Reject(context, error).FromJust();
+  }
+
+  delete job;
+  uv_close(reinterpret_cast<uv_handle_t *>(async),
+           [](uv_handle_t *handle) { delete reinterpret_cast<AsyncImageJob *>(handle->data); });
+}
+
+/**
+ * Shared by `exportImage(path, ...)`, `importImage(path, ...)` and `verify(...)`, which all take
+ * `offset, length, cipher?, checksum?, threads?, onProgress?` and resolve to the checksum.
+ */
+void RunImageMethod(const FunctionCallbackInfo<Value> &args, ImageMode mode) {
+  Isolate *isolate = args.GetIsolate();
+  Local<Context> context = isolate->GetCurrentContext();
+
+  // validate arguments from js
+  int base = mode == ImageMode::Verify ? 0 : 1;
+  DeviceCipher cipher;
+  bool hasCipher = false;
+  if (args.Length() < base + 2 || (base == 1 && !args[0]->IsString()) || !args[base]->IsNumber() ||
+      !args[base + 1]->IsNumber() || !GetDeviceCipher(isolate, args[base + 2], &cipher, &hasCipher) ||
+      !(args[base + 3]->IsUndefined() || args[base + 3]->IsString()) ||
+      !(args[base + 5]->IsUndefined() || args[base + 5]->IsFunction())) {
+    isolate->ThrowException(String::NewFromUtf8(isolate, "invalid arguments").ToLocalChecked());
+    return;
+  }
+
+  // extract arguments from js
+  ImageOptions options;
+  options.mode = mode;
+  if (base == 1) {
+    String::Utf8Value path(isolate, args[0]);
+    options.path = *path;
+  }
+  options.offset = args[base]->NumberValue(context).FromJust();
+  options.length = args[base + 1]->NumberValue(context).FromJust();
+  options.checksum = ImageChecksum::None;
+  if (args[base + 3]->IsString()) {
+    String::Utf8Value checksum(isolate, args[base + 3]);
+    std::string name = *checksum;
+    if (name == "sha256") {
+      options.checksum = ImageChecksum::Sha256;
+    } else if (name == "crc32") {
+      options.checksum = ImageChecksum::Crc32;
+    } else {
+      isolate->ThrowException(String::NewFromUtf8(isolate, "unknown checksum").ToLocalChecked());
+      return;
+    }
+  }
+  options.threads = args[base + 4]->IsNumber() ? args[base + 4]->Int32Value(context).FromJust() : 0;
+  if (options.threads <= 0)
+    options.threads = DefaultThreadCount();
+
+  NandDeviceInstance *instance =
+      reinterpret_cast<NandDeviceInstance *>(args.Holder()->GetAlignedPointerFromInternalField(0));
+  if (instance->busy) {
+    ThrowUvError(isolate, UV_EBUSY);
+    return;
+  }
+
+  Local<Promise::Resolver> resolver = Promise::Resolver::New(context).ToLocalChecked();
+  args.GetReturnValue().Set(resolver->GetPromise());
+
+  AsyncImageJob *imageJob = new AsyncImageJob();
+  imageJob->isolate = isolate;
+  imageJob->context.Reset(isolate, context);
+  imageJob->resolver.Reset(isolate, resolver);
+  imageJob->holder.Reset(isolate, args.Holder());
+  imageJob->cipher.Reset(isolate, args[base + 2]);
+  if (args[base + 5]->IsFunction())
+    imageJob->onProgress.Reset(isolate, args[base + 5].As<Function>());
+  imageJob->instance = instance;
+  imageJob->job = new ImageJob(instance->device, options, hasCipher ? &cipher : nullptr);
+  imageJob->bytesDone = 0;
+  imageJob->done = false;
+  imageJob->success = false;
+  imageJob->reportedBytes = 0;
+
+  instance->busy = true;
+  uv_async_init(node::GetCurrentEventLoop(isolate), &imageJob->async, CompleteImageJob);
+  imageJob->async.data = imageJob;
+
+  // the job blocks for the whole partition, so it gets its own thread rather than holding a threadpool slot
+  imageJob->thread = std::thread([imageJob]() {
+    imageJob->success = imageJob->job->Run([imageJob](uint64_t bytesDone) {
+      imageJob->bytesDone = bytesDone;
+      uv_async_send(&imageJob->async);
+    });
+    imageJob->done = true;
+    uv_async_send(&imageJob->async);
+  });
+}
+
+void ExportImageDeviceMethod(const FunctionCallbackInfo<Value> &args) { RunImageMethod(args, ImageMode::Export); }
+
+void ImportImageDeviceMethod(const FunctionCallbackInfo<Value> &args) { RunImageMethod(args, ImageMode::Import); }
+
+void VerifyDeviceMethod(const FunctionCallbackInfo<Value> &args) { RunImageMethod(args, ImageMode::Verify); }
+
 void Initialize(Local<Object> exports, Local<Object> module) {
   Isolate *isolate = exports->GetIsolate();
 
@@ -226,9 +672,30 @@ void Initialize(Local<Object> exports, Local<Object> module) {
 
   // setup methods for XtsnCipher instances
   NODE_SET_PROTOTYPE_METHOD(tpl, "run", RunCipherMethod);
-
-  // set the default export to be the XtsnCipher constructor
+  NODE_SET_PROTOTYPE_METHOD(tpl, "runAsync", RunAsyncCipherMethod);
+  cipherTemplate.Reset(isolate, tpl);
+
+  // setup storage for the NandDevice class
+  Local<FunctionTemplate> deviceTpl = FunctionTemplate::New(isolate, CreateNandDeviceInstance);
+  deviceTpl->SetClassName(String::NewFromUtf8(isolate, "NandDevice").ToLocalChecked());
+  deviceTpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  // setup methods for NandDevice instances
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "read", ReadDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "write", WriteDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "size", SizeDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "close", CloseDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "exportImage", ExportImageDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "importImage", ImportImageDeviceMethod);
+  NODE_SET_PROTOTYPE_METHOD(deviceTpl, "verify", VerifyDeviceMethod);
+
+  // set the default export to be the XtsnCipher constructor, with NandDevice hanging off it
   auto constructorFunction = tpl->GetFunction(isolate->GetCurrentContext()).ToLocalChecked();
+  auto deviceConstructorFunction = deviceTpl->GetFunction(isolate->GetCurrentContext()).ToLocalChecked();
+  constructorFunction
+      ->Set(isolate->GetCurrentContext(), String::NewFromUtf8(isolate, "NandDevice").ToLocalChecked(),
+            deviceConstructorFunction)
+      .FromJust();
   module
       ->Set(isolate->GetCurrentContext(), String::NewFromUtf8(isolate, "exports").ToLocalChecked(), constructorFunction)
       .FromJust();
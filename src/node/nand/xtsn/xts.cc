@@ -0,0 +1,153 @@
+#include "xts.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace xtsn {
+
+constexpr uint64_t kBatchBlocks = kBatchSize / kBlockSize;
+
+/**
+ * Multiply the tweak by x in GF(2^128), with the tweak stored as two little-endian 64 bit halves.
+ */
+inline void DoubleTweak(uint64_t &lo, uint64_t &hi) {
+  uint64_t carry = hi >> 63;
+  hi = hi << 1 | lo >> 63;
+  lo = lo << 1 ^ (carry * 0x87);
+}
+
+inline void WriteSectorNumber(unsigned char *block, uint64_t sector) {
+  memset(block, 0, 8);
+#if defined(__GNUC__) || defined(__clang__)
+  uint64_t sectorBigEndian = __builtin_bswap64(sector);
+  memcpy(block + 8, &sectorBigEndian, sizeof(uint64_t));
+#elif defined(_MSC_VER)
+  uint64_t sectorBigEndian = _byteswap_uint64(sector);
+  memcpy(block + 8, &sectorBigEndian, sizeof(uint64_t));
+#else
+  for (int i = 0; i < sizeof(uint64_t); i++)
+    block[15 - i] = ((unsigned char *)&sector)[i];
+#endif
+}
+
+inline void XorBlocks(unsigned char *data, const unsigned char *tweaks, uint64_t length) {
+#if defined(__SSE2__) || defined(_M_X64)
+  for (uint64_t i = 0; i < length; i += kBlockSize) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tweaks + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_xor_si128(d, t));
+  }
+#elif defined(__ARM_NEON)
+  for (uint64_t i = 0; i < length; i += kBlockSize) {
+    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), vld1q_u8(tweaks + i)));
+  }
+#else
+  for (uint64_t i = 0; i < length; i += sizeof(uint64_t)) {
+    uint64_t d, t;
+    memcpy(&d, data + i, sizeof(uint64_t));
+    memcpy(&t, tweaks + i, sizeof(uint64_t));
+    d ^= t;
+    memcpy(data + i, &d, sizeof(uint64_t));
+  }
+#endif
+}
+
+/**
+ * Fill `tweaks` with the tweak for each of the next `blocks` blocks, starting at block `block` of sector `sector`.
+ * The initial tweak of every sector in the run is encrypted with a single call, and both `sector` and `block` are
+ * advanced past the run.
+ */
+void BuildTweaks(EVP_CIPHER_CTX *ctx_tweak, unsigned char *tweaks, unsigned char *seeds, uint64_t blocks,
+                 uint64_t &sector, uint64_t &block, uint64_t blocksPerSector) {
+  // write out the (big-endian) sector number for every sector this run touches
+  uint64_t seedCount = 0;
+  for (uint64_t done = 0, b = block; done < blocks; b = 0) {
+    WriteSectorNumber(seeds + seedCount * kBlockSize, sector + seedCount);
+    done += std::min(blocksPerSector - b, blocks - done);
+    seedCount++;
+  }
+
+  int outputLen = 0;
+  int ok = EVP_CipherUpdate(ctx_tweak, seeds, &outputLen, seeds, seedCount * kBlockSize);
+  assert(ok);
+  (void)ok;
+
+  // now expand each sector's encrypted tweak into one tweak per block
+  unsigned char *out = tweaks;
+  for (uint64_t i = 0, done = 0; done < blocks; i++) {
+    uint64_t lo, hi;
+    memcpy(&lo, seeds + i * kBlockSize, sizeof(uint64_t));
+    memcpy(&hi, seeds + i * kBlockSize + 8, sizeof(uint64_t));
+
+    // catch up to the first block we need if we're starting part way through the sector
+    for (uint64_t j = 0; j < block; j++) {
+      DoubleTweak(lo, hi);
+    }
+
+    uint64_t count = std::min(blocksPerSector - block, blocks - done);
+    for (uint64_t j = 0; j < count; j++) {
+      memcpy(out, &lo, sizeof(uint64_t));
+      memcpy(out + 8, &hi, sizeof(uint64_t));
+      out += kBlockSize;
+      DoubleTweak(lo, hi);
+    }
+
+    done += count;
+    block += count;
+    if (block == blocksPerSector) {
+      block = 0;
+      sector++;
+    }
+  }
+}
+
+void RunXts(EVP_CIPHER_CTX *ctx_tweak, EVP_CIPHER_CTX *ctx_crypto, unsigned char *data, uint64_t length,
+            uint64_t sectorOffset, uint64_t skippedBytes, uint64_t sectorSize) {
+  // scratch space is kept per thread so repeated calls don't allocate
+  thread_local std::vector<unsigned char> tweaks(kBatchSize);
+  thread_local std::vector<unsigned char> seeds(kBatchSize);
+
+  // the tweak for a block can't be derived part way through it, so callers have to start on a block boundary
+  assert(skippedBytes % kBlockSize == 0);
+
+  uint64_t blocksPerSector = sectorSize / kBlockSize;
+  uint64_t totalBlocks = length / kBlockSize;
+
+  // skip any full sectors, and then work out which block in the sector we start from
+  uint64_t sector = sectorOffset + skippedBytes / sectorSize;
+  uint64_t block = (skippedBytes % sectorSize) / kBlockSize;
+
+  uint64_t done = 0;
+  while (done < totalBlocks) {
+    uint64_t batchBlocks = std::min(totalBlocks - done, kBatchBlocks);
+
+    // try to end each batch on a sector boundary, so the next batch doesn't need to catch up a partial tweak
+    uint64_t tail = (block + batchBlocks) % blocksPerSector;
+    if (batchBlocks < totalBlocks - done && tail < batchBlocks) {
+      batchBlocks -= tail;
+    }
+
+    unsigned char *batch = data + done * kBlockSize;
+    uint64_t batchLength = batchBlocks * kBlockSize;
+    BuildTweaks(ctx_tweak, tweaks.data(), seeds.data(), batchBlocks, sector, block, blocksPerSector);
+
+    XorBlocks(batch, tweaks.data(), batchLength);
+    int outputLen = 0;
+    int ok = EVP_CipherUpdate(ctx_crypto, batch, &outputLen, batch, batchLength);
+    assert(ok);
+    (void)ok;
+    XorBlocks(batch, tweaks.data(), batchLength);
+
+    done += batchBlocks;
+  }
+}
+
+} // namespace xtsn
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <openssl/evp.h>
+
+namespace xtsn {
+
+/**
+ * AES works on 128 bit (16 byte) blocks
+ */
+constexpr uint64_t kBlockSize = 16;
+
+/**
+ * Maximum number of bytes processed by a single batch in `RunXts`. The tweak
+ * stream for a batch is built up-front in a buffer of this size, so it should
+ * comfortably fit in L2 while still being large enough that OpenSSL can make
+ * use of its pipelined (AES-NI, etc) multi-block code paths.
+ */
+constexpr uint64_t kBatchSize = 0x10000;
+
+/**
+ * Run the Nintendo flavoured AES-XTS cipher over `data` in-place.
+ *
+ * Unlike regular XTS, the sector number is encoded as a big-endian 128 bit
+ * integer when creating the initial tweak for each sector.
+ *
+ * @param ctx_tweak ECB encrypt context for the tweak key
+ * @param ctx_crypto ECB encrypt or decrypt context for the crypto key
+ * @param data the data to encrypt or decrypt, only whole blocks are processed
+ * @param length length of `data` in bytes
+ * @param sectorOffset the sector that `data` starts in
+ * @param skippedBytes number of bytes into `sectorOffset` that `data` starts at, must be a multiple of `kBlockSize`
+ * @param sectorSize sector size in bytes, must be a multiple of `kBlockSize`
+ */
+void RunXts(EVP_CIPHER_CTX *ctx_tweak, EVP_CIPHER_CTX *ctx_crypto, unsigned char *data, uint64_t length,
+            uint64_t sectorOffset, uint64_t skippedBytes, uint64_t sectorSize);
+
+} // namespace xtsn